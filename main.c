@@ -4,14 +4,41 @@
 #include <unistd.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+/* Table size, 5 plays Briscola Chiamata, 2 and 4 play Briscola with a stock. Other formats are separate builds selected at run time */
+/* with -v, built next to the 5 player one: */
+/*   cc -O2 -o briscola main.c -lm -lpthread */
+/*   cc -O2 -Dn_players=2 -o briscola_2 main.c -lm -lpthread */
+/*   cc -O2 -Dn_players=4 -o briscola_4 main.c -lm -lpthread */
+#ifndef n_players
 #define n_players 5
-#define n_hand 8
+#endif
+#if n_players != 2 && n_players != 4 && n_players != 5
+#error "n_players must be 2, 4 or 5"
+#endif
 #define n_cards 40
+#if n_players == 5
+#define n_hand (n_cards/n_players)
+#else
+#define n_hand 3
+#endif
+/* Cards left after the deal form the stock, drawn one each after every trick by the taker first, the last is turned up and names briscola */
+#define n_stock (n_cards - n_players*n_hand)
+#ifndef minimax_depth
 #define minimax_depth 4
+#endif
 
 typedef struct card{
     int value;
@@ -22,7 +49,16 @@ typedef struct card{
 const int relative_value[10] = {1, 2, 3, 5, 7, 10, 15, 20, 75, 150};
 const int true_value[10] = {0, 0, 0, 0, 0, 2, 3, 4, 10, 11};
 
-size_t getline(char **lineptr, size_t *n, FILE *stream) {
+/* When 0, bots play silently on the calling thread (batch and ponder threads search without printing) */
+_Thread_local int verbose = 1;
+
+/* Depth of bot searches in opponent plays, defaults to minimax_depth */
+int search_depth = minimax_depth;
+
+/* Opponent replies searched at full depth by selective search (0 searches every reply fully), later replies are reduced */
+int selective_width = 0;
+
+size_t read_line(char **lineptr, size_t *n, FILE *stream) {
     char *bufptr = NULL;
     char *p = bufptr;
     size_t size;
@@ -82,6 +118,13 @@ typedef struct player{
     card hand[n_hand];
 } player;
 
+typedef struct game_result{
+    int caller;
+    card final_call;
+    int team[n_players];
+    int eval;
+} game_result;
+
 typedef struct game_state{
     player p;
     int partner_prob[n_players];
@@ -93,16 +136,87 @@ typedef struct game_state{
     int turn;
     int bris;
     int num_cards_played;
+    int stock;              //Cards left in the stock
+    card turned;            //Briscola turned up, drawn last from the stock (null in Chiamata)
 } game_state;
 
+/* Longest position string produced by position_string, including the terminating null */
+#define position_string_len 256
+
+/* Appends card c to buf as its two digit form ex. 03, or "--" for the null card, returns the advanced buf */
+char* put_card(char* buf, card c){
+    if(c.value == -1){
+        *buf++ = '-';
+        *buf++ = '-';
+    }else{
+        *buf++ = '0' + c.value;
+        *buf++ = '0' + c.suit;
+    }
+    return buf;
+}
+
+/* Writes the compact position string of position into buf (at least position_string_len bytes), fields are space separated: */
+/* pov, hand (n_hand slots), played (in order, "-" if none), tabled (n_players slots), taken per player ('/' separated, "-" if none), */
+/* starting, turn, bris and teams (one of '+', '-' or '0' per player), then in the formats with a stock the briscola turned up. */
+/* Ex. "2 03444281917201-- 0344 ----0344---- -/-/-/-/- 0 2 1 +-+--", or with 2 players "0 114203 - ---- -/- 0 0 1 +- 61" */
+void position_string(game_state position, char* buf){
+    buf += sprintf(buf, "%d ", position.p.position);
+    for(int i = 0; i < n_hand; i++){
+        buf = put_card(buf, position.p.hand[i]);
+    }
+    *buf++ = ' ';
+    if(position.num_cards_played == 0){
+        *buf++ = '-';
+    }
+    for(int i = 0; i < position.num_cards_played; i++){
+        buf = put_card(buf, position.cards_played[i]);
+    }
+    *buf++ = ' ';
+    //Only the trick in progress, the slots after turn still hold the cards of the trick taken before
+    for(int i = 0; i < n_players; i++){
+        card none = {-1, -1};
+        buf = put_card(buf, i < position.turn ? position.cards_tabled[i] : none);
+    }
+    *buf++ = ' ';
+    for(int i = 0; i < n_players; i++){
+        int taken = 0;
+        for(int j = 0; j < n_cards; j++){
+            if(position.cards_taken[i][j].value != -1){
+                buf = put_card(buf, position.cards_taken[i][j]);
+                taken++;
+            }
+        }
+        if(taken == 0){
+            *buf++ = '-';
+        }
+        *buf++ = (i < n_players - 1) ? '/' : ' ';
+    }
+    buf += sprintf(buf, "%d %d %d ", position.starting, position.turn, position.bris);
+    for(int i = 0; i < n_players; i++){
+        *buf++ = position.partner_prob[i] > 0 ? '+' : (position.partner_prob[i] < 0 ? '-' : '0');
+    }
+    if(n_stock > 0){
+        *buf++ = ' ';
+        buf = put_card(buf, position.turned);
+    }
+    *buf = '\0';
+}
+
 /* Prints specs of param position */
 void print_state(game_state position){
 
+    char str[position_string_len];
+    position_string(position, str);
+
     printf("\n");
+    printf("Position: %s\n", str);
     printf("Pov Position: %d\n", position.p.position);
     printf("Starting index: %d\n", position.starting);
     printf("Turn: %d\n", position.turn);
     printf("Bris: %d\n", position.bris);
+    if(n_stock > 0){
+        printf("Stock: %d (turned up %d%d)\n", position.stock, position.turned.value, position.turned.suit);
+    }
 
     printf("Pov hand: ");
     for(int i = 0; i < n_hand; i++){
@@ -165,14 +279,22 @@ void print_hand(player p){
     printf("\n");
 }
 
+/* Returns the next number of the splitmix64 generator with the given state */
+unsigned long long splitmix64(unsigned long long* state){
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* State of the deal shuffler, seeded once at startup and saved by checkpoints so a resumed run deals the same games */
+unsigned long long deal_rng = 0;
+
 /* In-place randomization of card_arr, n = sizeof card_arr */
 int shuffle_card_arr(card* card_arr, size_t n) {
-    // Seed the random number generator
-    srand(time(NULL));
-
     for (size_t i = n - 1; i > 0; i--) {
         // Generate a random index j such that 0 <= j <= i
-        size_t j = rand() % (i + 1);
+        size_t j = splitmix64(&deal_rng) % (i + 1);
 
         // Swap card_arr[i] and card_arr[j]
         card temp = card_arr[i];
@@ -232,6 +354,8 @@ void cp_state(game_state state, game_state* dest){
     dest->bris = state.bris;
     dest->num_cards_played = state.num_cards_played;
     dest->turn = state.turn;
+    dest->stock = state.stock;
+    dest->turned = state.turned;
 }
 
 /* Makes card c a null card {-1, -1}*/
@@ -303,7 +427,7 @@ int collect_table(game_state* position){
         index_highest = highest_card(position->cards_tabled, n_players, position->cards_tabled[0].suit);
     }
     int offset = 0;
-    int player_reward = (index_highest+position->starting)%5;
+    int player_reward = (index_highest+position->starting)%n_players;
     for(int i = 0; i < n_cards; i++){
         if(position->cards_taken[player_reward][i].value == -1){
             offset = i;
@@ -323,6 +447,239 @@ int init_set_null(card* set, int n){
     }
 }
 
+/* Reads up to max cards from the two digit run at *str into set (null slots "--" allowed if nulls), advancing *str, returns cards read or -1 */
+int get_cards(const char** str, card* set, int max, int nulls){
+    const char* p = *str;
+    int n = 0;
+    if(*p == '-' && (p[1] == ' ' || p[1] == '/' || p[1] == '\0')){
+        *str = p + 1;
+        return 0;
+    }
+    while(*p != ' ' && *p != '/' && *p != '\0' && *p != '\n'){
+        if(n >= max || p[1] == '\0'){
+            return -1;
+        }
+        if(p[0] == '-' && p[1] == '-' && nulls){
+            set_null(&set[n]);
+        }else if(p[0] >= '0' && p[0] <= '9' && p[1] >= '0' && p[1] <= '3'){
+            set[n].value = p[0] - '0';
+            set[n].suit = p[1] - '0';
+        }else{
+            return -1;
+        }
+        n++;
+        p += 2;
+    }
+    *str = p;
+    return n;
+}
+
+/* Reads a non-negative integer below limit at *str, advancing *str, returns the integer or -1 */
+int get_field(const char** str, int limit){
+    const char* p = *str;
+    int n = 0;
+    if(*p < '0' || *p > '9'){
+        return -1;
+    }
+    while(*p >= '0' && *p <= '9'){
+        n = n*10 + (*p - '0');
+        if(n >= limit){
+            return -1;
+        }
+        p++;
+    }
+    *str = p;
+    return n;
+}
+
+/* Skips the single space between position string fields, returns 0 if it was there */
+int get_space(const char** str){
+    if(**str != ' '){
+        return -1;
+    }
+    (*str)++;
+    return 0;
+}
+
+/* Sets position from the position string str (see position_string), cards_remaining holds every card not yet played */
+/* and the stock is what the tricks collected so far leave of it */
+/* Returns 0 on success, -1 if str is malformed or inconsistent */
+int parse_position(const char* str, game_state* position){
+    int seen[n_cards] = {0};
+
+    init_set_null(position->p.hand, n_hand);
+    init_set_null(position->cards_played, n_cards);
+    init_set_null(position->cards_tabled, n_players);
+    for(int i = 0; i < n_players; i++){
+        init_set_null(position->cards_taken[i], n_cards);
+    }
+
+    int pov = get_field(&str, n_players);
+    if(pov == -1 || get_space(&str)) return -1;
+    position->p.position = pov;
+    position->p.bot = 1;
+    position->p.calling = 0;
+
+    if(get_cards(&str, position->p.hand, n_hand, 1) != n_hand || get_space(&str)) return -1;
+    int played = get_cards(&str, position->cards_played, n_cards, 0);
+    if(played == -1 || get_space(&str)) return -1;
+    position->num_cards_played = played;
+    if(get_cards(&str, position->cards_tabled, n_players, 1) != n_players || get_space(&str)) return -1;
+    for(int i = 0; i < n_players; i++){
+        if(get_cards(&str, position->cards_taken[i], n_cards, 0) == -1) return -1;
+        if(i < n_players - 1 && *str++ != '/') return -1;
+    }
+    if(get_space(&str)) return -1;
+
+    position->starting = get_field(&str, n_players);
+    if(position->starting == -1 || get_space(&str)) return -1;
+    position->turn = get_field(&str, n_players + 1);
+    if(position->turn == -1 || get_space(&str)) return -1;
+    position->bris = get_field(&str, 4);
+    if(position->bris == -1 || get_space(&str)) return -1;
+    for(int i = 0; i < n_players; i++){
+        if(*str == '+'){
+            position->partner_prob[i] = 1;
+        }else if(*str == '-'){
+            position->partner_prob[i] = -1;
+        }else if(*str == '0'){
+            position->partner_prob[i] = 0;
+        }else return -1;
+        str++;
+    }
+    set_null(&position->turned);
+    if(n_stock > 0 && (get_space(&str) || get_cards(&str, &position->turned, 1, 0) != 1 || position->turned.suit != position->bris)) return -1;
+    if(*str != '\0' && *str != '\n') return -1;
+    position->p.team = position->partner_prob[pov];
+    position->stock = MAX(0, n_stock - n_players*((played - position->turn)/n_players));
+
+    //Every card is either in the pov hand or played once, tabled and taken cards must have been played
+    for(int i = 0; i < played; i++){
+        card c = position->cards_played[i];
+        if(seen[c.suit*10 + c.value]++) return -1;
+    }
+    for(int i = 0; i < n_hand; i++){
+        card c = position->p.hand[i];
+        if(c.value != -1 && seen[c.suit*10 + c.value]++) return -1;
+    }
+    //The turned up card stays on the table until the last draw
+    if(n_stock > 0 && position->stock > 0 && seen[position->turned.suit*10 + position->turned.value]) return -1;
+    //The trick in progress holds the last turn cards played in the order they were played, every earlier card was taken by someone
+    if(position->turn != played % n_players) return -1;
+    int taken = 0;
+    for(int i = 0; i < n_players; i++){
+        if((position->cards_tabled[i].value != -1) != (i < position->turn)) return -1;
+        if(i < position->turn){
+            card c = position->cards_played[played - position->turn + i];
+            if(position->cards_tabled[i].value != c.value || position->cards_tabled[i].suit != c.suit) return -1;
+        }
+        for(int j = 0; j < n_cards; j++){
+            if(position->cards_taken[i][j].value != -1){
+                if(contains(position->cards_played, played - position->turn, position->cards_taken[i][j]) == -1) return -1;
+                taken++;
+            }
+        }
+    }
+    if(taken + position->turn != played) return -1;
+
+    for(int i = 0; i < n_cards; i++){
+        make_card(&position->cards_remaining[i], (i%10)*10 + i/10);
+        if(contains(position->cards_played, played, position->cards_remaining[i]) >= 0){
+            set_null(&position->cards_remaining[i]);
+        }
+    }
+    return 0;
+}
+
+/* Tunable parameters of evaluation and calling_suit, the defaults are the original hand-set values (see -t and -e) */
+/* Evaluation weights are fixed point in units of 1/eval_scale */
+#define eval_scale 64
+
+typedef struct eval_params{
+    int taken;                      //Weight of points already taken
+    int weight[n_cards + 1];        //Weight of points still in play, by number of cards played
+    int bris;                       //Weight of points in play per briscola held
+    int held;                       //Weight of the rank (1 to 10) of each briscola in the pov's hand, for its team
+    int relative_value[10];         //Calling strength of each card value
+    int call_limit;                 //Strength a suit needs to raise a call
+} eval_params;
+
+eval_params params;
+
+/* Sets p to the default parameters */
+void default_params(eval_params* p){
+    p->taken = eval_scale;
+    for(int i = 0; i <= n_cards; i++){
+        float played = i;
+        int weight = n_players - played/((n_cards/4)*3);
+        p->weight[i] = weight * eval_scale;
+    }
+    p->bris = eval_scale;
+    p->held = 0;
+    memcpy(p->relative_value, relative_value, sizeof(p->relative_value));
+    p->call_limit = relative_call_limit;
+}
+
+/* Writes p to out in the format read by load_params */
+void write_params(FILE* out, eval_params* p){
+    fprintf(out, "# Briscola evaluation parameters\n");
+    fprintf(out, "scale %d\n", eval_scale);
+    fprintf(out, "taken %d\n", p->taken);
+    fprintf(out, "weight");
+    for(int i = 0; i <= n_cards; i++){
+        fprintf(out, " %d", p->weight[i]);
+    }
+    fprintf(out, "\nbris %d\n", p->bris);
+    fprintf(out, "held %d\n", p->held);
+    fprintf(out, "relative_value");
+    for(int i = 0; i < 10; i++){
+        fprintf(out, " %d", p->relative_value[i]);
+    }
+    fprintf(out, "\ncall_limit %d\n", p->call_limit);
+}
+
+/* When the user uses -e or -b flag, replaces the parameters in p with the ones in the file at path, fields not in the file keep their value */
+void load_params(char* path, eval_params* p){
+    FILE* f = fopen(path, "r");
+    if(f == NULL){
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    char name[64];
+    int ok = 1;
+    while(ok && fscanf(f, " %63s", name) == 1){
+        if(name[0] == '#'){
+            fscanf(f, "%*[^\n]");
+        }else if(strcmp(name, "scale") == 0){
+            int scale;
+            ok = (fscanf(f, "%d", &scale) == 1 && scale == eval_scale);
+        }else if(strcmp(name, "taken") == 0){
+            ok = (fscanf(f, "%d", &p->taken) == 1);
+        }else if(strcmp(name, "weight") == 0){
+            for(int i = 0; ok && i <= n_cards; i++){
+                ok = (fscanf(f, "%d", &p->weight[i]) == 1);
+            }
+        }else if(strcmp(name, "bris") == 0){
+            ok = (fscanf(f, "%d", &p->bris) == 1);
+        }else if(strcmp(name, "held") == 0){
+            ok = (fscanf(f, "%d", &p->held) == 1);
+        }else if(strcmp(name, "relative_value") == 0){
+            for(int i = 0; ok && i < 10; i++){
+                ok = (fscanf(f, "%d", &p->relative_value[i]) == 1);
+            }
+        }else if(strcmp(name, "call_limit") == 0){
+            ok = (fscanf(f, "%d", &p->call_limit) == 1);
+        }else{
+            ok = 0;
+        }
+    }
+    fclose(f);
+    if(!ok){
+        fprintf(stderr, "Error: Invalid parameter \"%s\" in %s.\n", name, path);
+        exit(EXIT_FAILURE);
+    }
+}
+
 /* Determines player p's strongest calling_suit considering the last_called value, -1 if not strong enough to call */
 int calling_suit(player p, int last_called){
     
@@ -354,16 +711,16 @@ int calling_suit(player p, int last_called){
     }
 
     for(int i = 0; i < n_spades; i++){
-        cv_spades += relative_value[spades[i]];
+        cv_spades += params.relative_value[spades[i]];
     }
     for(int i = 0; i < n_clubs; i++){
-        cv_clubs += relative_value[clubs[i]];
+        cv_clubs += params.relative_value[clubs[i]];
     }
     for(int i = 0; i < n_hearts; i++){
-        cv_hearts += relative_value[hearts[i]];
+        cv_hearts += params.relative_value[hearts[i]];
     }
     for(int i = 0; i < n_diamonds; i++){
-        cv_diamonds += relative_value[diamonds[i]];
+        cv_diamonds += params.relative_value[diamonds[i]];
     }
 
     int cv_max;
@@ -385,7 +742,7 @@ int calling_suit(player p, int last_called){
         return -1;
     }
 
-    int rv_last_called = relative_value[last_called];
+    int rv_last_called = params.relative_value[last_called];
     int rcv_spades, rcv_clubs, rcv_hearts, rcv_diamonds = 100;
     
     rcv_spades = cv_spades * n_spades * rv_last_called + bonus;
@@ -394,7 +751,7 @@ int calling_suit(player p, int last_called){
     rcv_diamonds = cv_diamonds * n_diamonds * rv_last_called + bonus;
 
     int rcv_max = MAX(rcv_spades, MAX(rcv_clubs, MAX(rcv_hearts, rcv_diamonds)));
-    if(rcv_max > relative_call_limit){
+    if(rcv_max > params.call_limit){
         if(rcv_max == rcv_spades){
             return 0;
         }
@@ -460,6 +817,11 @@ int setup_state(game_state* position, card* card_arr, player* players, int start
     position->num_cards_played = 0;
     position->starting = start;
     position->turn = 0;
+    position->stock = n_stock;
+    set_null(&position->turned);
+    if(n_stock > 0){
+        cp_card(card_arr[n_cards-1], &position->turned);
+    }
 }
 
 /* Transfers the pov of the game_state to the next player, deep copies current pov back to player array and next player into pov */
@@ -474,6 +836,21 @@ int next_state(game_state* position, player* players, int new_starting){
 
 }
 
+/* After a trick of the game, deals the next card of the stock in card_arr to every player from the starting one (who took the trick) */
+void draw_cards(game_state* game, player* players, card* card_arr){
+    if(game->stock == 0){
+        return;
+    }
+    card null = {-1, -1};
+    cp_set(game->p.hand, players[game->p.position].hand, n_hand);
+    for(int i = 0; i < n_players; i++){
+        player* p = &players[(game->starting + i) % n_players];
+        cp_card(card_arr[n_cards - game->stock], &p->hand[contains(p->hand, n_hand, null)]);
+        game->stock--;
+    }
+    cp_set(players[game->p.position].hand, game->p.hand, n_hand);
+}
+
 /* Plays card c into the position given, deep copies card into both cards_played and cards_tabled, increments num_cards_played and turn */
 int play_card(game_state* position, card c){
     cp_card(c, &position->cards_played[position->num_cards_played]);
@@ -482,212 +859,719 @@ int play_card(game_state* position, card c){
     position->turn++;
 }
 
+/* Nulls card c in the cards_remaining of position, as the game does once the pov player's card is played */
+void remove_remaining(game_state* position, card c){
+    int index = contains(position->cards_remaining, n_cards, c);
+    if(index != -1){
+        set_null(&position->cards_remaining[index]);
+    }
+}
+
 /* Determines if game is over by num_cards_played */
 int game_over(game_state position){
-    if(position.num_cards_played >= 40) return 1;
+    if(position.num_cards_played >= n_cards) return 1;
     return 0;
 }
 
+/* Computes the terms evaluation weighs for an unfinished position: team points taken, points in play, points in play times briscola held, */
+/* and the ranks of the briscole in the pov's hand */
+void eval_features(game_state* position, int* features){
+    features[0] = features[1] = features[2] = features[3] = 0;
+    for(int i = 0; i < n_hand; i++){
+        if(position->p.hand[i].value != -1 && position->p.hand[i].suit == position->bris){
+            features[3] += position->p.team * (position->p.hand[i].value + 1);
+        }
+    }
+    for(int i = 0; i < n_players; i++){
+        features[0] += position->partner_prob[i] * score(position->cards_taken[i], n_cards);
+        if(i == position->p.position){
+            features[1] += score(position->p.hand, n_hand);
+            features[2] += position->p.team * score(position->cards_remaining, n_cards) * num_of_suit(position->p.hand, n_hand, position->bris);
+        }else{
+            features[1] += score(position->cards_remaining, n_cards);
+            features[2] += position->p.team * score(position->cards_remaining, n_cards) * num_of_suit(position->cards_remaining, n_cards, position->bris);
+        }
+    }
+}
+
 /* Evaluates position by the total sum of taken cards multiplied by the team of the player who took them */
 /* eval > 0 means that the caller/partner is winning, eval < 0 means that the corp is winning */
 int evaluation(game_state position){
     int sum = 0;
-    if(position.num_cards_played >= 40){
+    if(position.num_cards_played >= n_cards){
         for(int i = 0; i < n_players; i++){
             sum += position.partner_prob[i] * score(position.cards_taken[i], n_cards);
         }
         return sum;
     }else{
-        float played = position.num_cards_played;
-        int weight = n_players - played/((n_cards/4)*3);
-        for(int i = 0; i < n_players; i++){
-            if(i == position.p.position){
-                sum += position.partner_prob[i] * score(position.cards_taken[i], n_cards)
-                        + (score(position.p.hand, n_cards) * weight)
-                        + (position.p.team * score(position.cards_remaining, n_cards) * num_of_suit(position.p.hand, n_hand, position.bris));
-            }else{
-                sum += position.partner_prob[i] * score(position.cards_taken[i], n_cards)
-                        + (score(position.cards_remaining, n_cards) * weight)
-                        + (position.p.team * score(position.cards_remaining, n_cards) * num_of_suit(position.cards_remaining, n_cards, position.bris));
-            }
-        }
-        return sum;
+        int features[4];
+        eval_features(&position, features);
+        sum = params.taken * features[0] + params.weight[position.num_cards_played] * features[1] + params.bris * features[2] + params.held * features[3];
+        return sum / eval_scale;
     }
 }
 
-/* Minimax algorithm to maximize or minimize (from param max) the evaluation at the depth given */
-int minimax(game_state* position, int max, int depth){
+/* Bounds beyond every value minimax can return, used as the initial alpha-beta window */
+#define minimax_inf 2000000
+#define cache_bits 20
 
-    if(depth <= 0 || game_over(*position)){
-        collect_table(position);
-        return evaluation(*position);
-    }
+#define cache_exact 0
+#define cache_lower 1
+#define cache_upper 2
 
-    int eval = max * -1000000;
-    if(position->turn < 5){
-        if(position->p.position == (position->starting+position->turn)%n_players){
-            for(int i = 0; i < n_hand; i++){
-                if(position->p.hand[i].value != -1){
-                    game_state new_position;
-                    cp_state(*position, &new_position);
-                    play_card(&new_position, position->p.hand[i]);
-                    set_null(&new_position.p.hand[i]);
-                    if(max > 0){
-                        eval = MAX(minimax(&new_position, position->partner_prob[(position->starting+position->turn)%n_players], depth), eval);
-                    }else{
-                        eval = MIN(minimax(&new_position, position->partner_prob[(position->starting+position->turn)%n_players], depth), eval);
-                    }
-                }
-            }
-        }else{
-            for(int i = 0; i < n_cards; i++){
-                if(position->cards_remaining[i].value != -1){
-                    if(contains(position->p.hand, n_hand, position->cards_remaining[i]) == -1){
-                        game_state new_position;
-                        cp_state(*position, &new_position);
-                        play_card(&new_position, position->cards_remaining[i]);
-                        set_null(&new_position.cards_remaining[i]);
-                        if(max > 0){
-                            eval = MAX(minimax(&new_position, position->partner_prob[(position->starting+position->turn)%n_players], depth-1), eval);
-                        }else{
-                            eval = MIN(minimax(&new_position, position->partner_prob[(position->starting+position->turn)%n_players], depth-1), eval);
-                        }
-                    }
-                }
-            }
-        }
-        return eval;
+/* Zobrist key slots: hand, remaining, tabled per slot, taken per player and index, then the scalar fields of the position */
+/* and the card turned up while it is in the stock (the stock itself follows from the cards played) */
+#define key_hand 0
+#define key_remaining (key_hand + n_cards)
+#define key_tabled (key_remaining + n_cards)
+#define key_taken (key_tabled + n_players*n_cards)
+#define key_turn (key_taken + n_players*n_cards*n_cards)
+#define key_starting (key_turn + n_players + 1)
+#define key_played (key_starting + n_players)
+#define key_pov (key_played + n_cards + 1)
+#define key_max (key_pov + n_players)
+#define key_bris (key_max + 3)
+#define key_partner (key_bris + 4)
+#define key_turned (key_partner + 3*n_players)
+#define key_size (key_turned + n_cards)
+
+typedef struct cache_entry{
+    unsigned long long key;
+    int value;
+    signed char depth;
+    signed char flag;
+    signed char best;
+    unsigned char age;
+} cache_entry;
+
+/* Transposition table of a thread, entries record the depth they were searched to and the best move found */
+/* Values searched at least as deep as needed are reused, shallower entries still give their best move to order the search */
+/* Entries outlive their decision, but keys hold the pov seat and its hand, so only the same seat's later decisions can find them, and */
+/* those start at or past the earlier search's horizon: the table pays off within a decision, carried entries save at most a few % */
+typedef struct search_cache{
+    cache_entry* entries;
+    unsigned char age;
+} search_cache;
+
+unsigned long long zobrist[key_size];
+pthread_once_t zobrist_once = PTHREAD_ONCE_INIT;
+
+/* Each thread searches with its own cache unless it is given one to share (see ponder) */
+_Thread_local search_cache* thread_cache = NULL;
+
+/* When set, searches on this thread abandon their work as soon as *search_stop is nonzero, storing nothing in the cache */
+_Thread_local int* search_stop = NULL;
+
+/* Fills zobrist with fixed pseudo random keys (splitmix64) */
+void init_zobrist(void){
+    unsigned long long x = 0x2545F4914F6CDD1DULL;
+    for(int i = 0; i < key_size; i++){
+        zobrist[i] = splitmix64(&x);
     }
-    int index_highest = collect_table(position);
-    position->starting = (index_highest + position->starting) % n_players;
-    position->turn = 0;
-    return minimax(position, position->partner_prob[position->starting], depth);
 }
 
-/* Given an evaluation array, returns the index of the best evaluation given if player is maximizing or minimizing */
-int index_to_play(int* eval_arr, player p){
-    int index = 0;
-    int eval = p.team * -1000000;
-    for(int i = 0; i < n_hand; i++){
-        if(p.hand[i].value != -1){
-            if(p.team > 0){
-                if(eval_arr[i] > eval){
-                    eval = eval_arr[i];
-                    index = i;
-                }
-            }else{
-                if(eval_arr[i] < eval){
-                    eval = eval_arr[i];
-                    index = i;
-                }
-            }
+/* Returns the cache of the calling thread, allocating it on first use */
+search_cache* get_cache(void){
+    if(thread_cache == NULL){
+        pthread_once(&zobrist_once, init_zobrist);
+        thread_cache = malloc(sizeof(search_cache));
+        thread_cache->entries = calloc(1 << cache_bits, sizeof(cache_entry));
+        thread_cache->age = 0;
+        if(thread_cache->entries == NULL){
+            perror("calloc");
+            exit(EXIT_FAILURE);
         }
     }
-    return index;
+    return thread_cache;
 }
 
-/* Given a game state, provides the maximal gain for pov player by evaluating each card in hand, returns the best evaluated card's index in hand */
-int make_decision(game_state game){
-    int eval_arr[n_hand];
-    for(int i = 0; i < n_hand; i++){
-        eval_arr[i] = game.p.team*-1000;
+/* Frees the cache of the calling thread, if it has its own */
+void free_cache(void){
+    if(thread_cache != NULL){
+        free(thread_cache->entries);
+        free(thread_cache);
+        thread_cache = NULL;
     }
+}
 
-    printf("Player %d hand: ", game.p.position);
-    print_hand(game.p);
+typedef struct parallel_run{
+    void (*item)(void*, int);
+    void* job;
+    int n_items;
+    int next_item;
+    pthread_mutex_t lock;
+} parallel_run;
 
-    for(int i = 0; i < n_hand; i++){
-        if(game.p.hand[i].value != -1){
-            game_state new_position;
-            cp_state(game, &new_position);
-            play_card(&new_position, game.p.hand[i]);
-            set_null(&new_position.p.hand[i]);
-            printf("trying card %d...", i);
-            eval_arr[i] = minimax(&new_position, game.p.team, minimax_depth);
-            printf("eval of %d\n", eval_arr[i]);
+/* Worker for run_parallel, repeatedly claims the next item of the run and does it silently, frees its cache once none are left */
+void* parallel_worker(void* arg){
+    parallel_run* run = arg;
+    verbose = 0;
+    while(1){
+        pthread_mutex_lock(&run->lock);
+        int i = run->next_item++;
+        pthread_mutex_unlock(&run->lock);
+        if(i >= run->n_items){
+            free_cache();
+            return NULL;
         }
+        run->item(run->job, i);
     }
-    return index_to_play(eval_arr, game.p);
 }
 
-/* Given predefined arrays of cards and players, play game among 5 bots */
-int simulate(card* card_arr, player* players){
-    
-    int callers = n_players;
-    int index = 0;
-    int caller = -1;
-    int calling_card = -1;
-    while(callers > 1){
-        int temp;
-        if(players[index%n_players].calling > 0){
-            temp = call(players[index%n_players], calling_card);
-            if(temp == -1){
-                players[index%n_players].calling = 0;
-                callers--;
-                index++;
-                continue;
-            }
-        }else{
-            index++;
-            continue;
-        }
-        caller = index%n_players;
-        calling_card = temp;
-        index++;
+/* Calls item(job, i) for every i below n_items on all cores, items are claimed in order, returns once every item is done */
+void run_parallel(void (*item)(void*, int), void* job, int n_items){
+    parallel_run run = {item, job, n_items, 0};
+    pthread_mutex_init(&run.lock, NULL);
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    n_threads = MAX(1, MIN(n_threads, n_items));
+    pthread_t* threads = malloc(sizeof(pthread_t) * n_threads);
+    if(threads == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
     }
-
-    card final_call = {calling_card, calling_suit(players[caller], -1)};
-    printf("Final Caller: Player %d calls %d of %d\n\n", caller, final_call.value, final_call.suit);
-
-    players[caller].team = 1;
-    for(int i = 0; i < n_players; i++){
-        if(contains(players[i].hand, n_hand, final_call) >= 0){
-            players[i].team = 1;
-            break;
-        }
+    for(int i = 0; i < n_threads; i++){
+        pthread_create(&threads[i], NULL, parallel_worker, &run);
     }
-
-    for(int i = 0; i < n_players; i++){
-        printf("Player %d team is %d\n", i, players[i].team);
+    for(int i = 0; i < n_threads; i++){
+        pthread_join(threads[i], NULL);
     }
-    printf("\n");
+    pthread_mutex_destroy(&run.lock);
+    free(threads);
+}
 
-    game_state game;
-    setup_state(&game, card_arr, players, caller, final_call);
-    
-    int count = 0;
-    int play;
-    while(game.num_cards_played < 40){
-        if(count%n_players == 0 && game.num_cards_played > 0){
-            game.starting = (collect_table(&game) + game.starting) % n_players;
-            next_state(&game, players, game.starting);
-            print_state(game);
-            printf("Current Evaluation: %d\n", evaluation(game));
-        }
-        if(game.num_cards_played == 0){
-            print_state(game);
+/* Maps the file at path read only and writes its size to size, returns NULL for an empty file, unmap with munmap */
+const char* map_file(const char* path, off_t* size){
+    int fd = open(path, O_RDONLY);
+    if(fd == -1){
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if(fstat(fd, &st) == -1){
+        perror("fstat");
+        exit(EXIT_FAILURE);
+    }
+    *size = st.st_size;
+    const char* text = NULL;
+    if(st.st_size > 0){
+        text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(text == MAP_FAILED){
+            perror("mmap");
+            exit(EXIT_FAILURE);
         }
-        play = make_decision(game);
-        printf("Player %d plays %d%d\n", game.p.position, game.p.hand[play].value, game.p.hand[play].suit);
-        play_card(&game, game.p.hand[play]);
-        set_null(&game.p.hand[play]);
-        set_null(&game.cards_remaining[play+(game.p.position*n_hand)]);
-        next_state(&game, players, (game.p.position+1) % n_players);
-        count++;
     }
+    close(fd);
+    return text;
+}
 
-    collect_table(&game);
-    print_state(game);
-    printf("Current Evaluation: %d\n", evaluation(game));
-
-    return evaluation(game);
+/* Returns the seconds since start, a CLOCK_MONOTONIC time */
+double elapsed(struct timespec start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
 }
 
-/* Given predefined arrays of cards and players, play game with predetermined number of bots */
-int run_game(card* card_arr, player* players){
+/* Returns 1 if the search on this thread has been cancelled */
+int search_stopped(void){
+    return search_stop != NULL && __atomic_load_n(search_stop, __ATOMIC_RELAXED);
+}
 
-    printf("Begin Calling Phase:\n"
-            "\tPlease enter a valid call (-1 to pass).\n");
+/* Returns the key of everything minimax's value depends on: hand, remaining, tabled and taken cards (taken by array index, */
+/* since collect_table writes at the first null), turn, starting, cards played, pov, bris, teams, turned card and the max param */
+unsigned long long position_key(game_state* position, int max){
+    unsigned long long key = 0;
+    for(int i = 0; i < n_hand; i++){
+        if(position->p.hand[i].value != -1){
+            key ^= zobrist[key_hand + position->p.hand[i].suit*10 + position->p.hand[i].value];
+        }
+    }
+    for(int i = 0; i < n_cards; i++){
+        if(position->cards_remaining[i].value != -1){
+            key ^= zobrist[key_remaining + position->cards_remaining[i].suit*10 + position->cards_remaining[i].value];
+        }
+    }
+    for(int i = 0; i < n_players; i++){
+        if(position->cards_tabled[i].value != -1){
+            key ^= zobrist[key_tabled + i*n_cards + position->cards_tabled[i].suit*10 + position->cards_tabled[i].value];
+        }
+        for(int j = 0; j < n_cards; j++){
+            if(position->cards_taken[i][j].value != -1){
+                key ^= zobrist[key_taken + (i*n_cards + j)*n_cards + position->cards_taken[i][j].suit*10 + position->cards_taken[i][j].value];
+            }
+        }
+        key ^= zobrist[key_partner + i*3 + position->partner_prob[i] + 1];
+    }
+    key ^= zobrist[key_turn + position->turn];
+    key ^= zobrist[key_starting + position->starting];
+    key ^= zobrist[key_played + position->num_cards_played];
+    key ^= zobrist[key_pov + position->p.position];
+    key ^= zobrist[key_max + max + 1];
+    key ^= zobrist[key_bris + position->bris];
+    if(position->stock > 0){
+        key ^= zobrist[key_turned + position->turned.suit*10 + position->turned.value];
+    }
+    return key;
+}
+
+/* Cheap guess of how likely player is to play card c into the current trick, higher is more likely */
+int reply_score(game_state* position, int player, card c){
+    int trump = (c.suit == position->bris);
+    if(position->turn == 0){
+        //Leading: get rid of small cards, keep points and briscola
+        return -relative_value[c.value] - trump*200;
+    }
+    int lead = position->cards_tabled[0].suit;
+    int index_highest = highest_card(position->cards_tabled, position->turn, position->bris);
+    if(index_highest == -1){
+        index_highest = highest_card(position->cards_tabled, position->turn, lead);
+    }
+    card top = position->cards_tabled[index_highest];
+    int points = 0;
+    for(int i = 0; i < position->turn; i++){
+        points += true_value[position->cards_tabled[i].value];
+    }
+    int follow = (c.suit == lead);
+    int wins = (c.suit == top.suit) ? c.value > top.value : trump;
+
+    if(position->partner_prob[(position->starting + index_highest) % n_players] == position->partner_prob[player]){
+        //Partner is winning: load points on the trick without trumping
+        return 100 + 10*true_value[c.value] - trump*200 + follow;
+    }
+    if(wins){
+        //Win the trick as cheaply as possible, more eagerly the more it is worth
+        return 100 + 10*points - relative_value[c.value] - trump*20;
+    }
+    //Duck: dump cards worth nothing
+    return -10*true_value[c.value] - relative_value[c.value]/10 + follow;
+}
+
+/* Move generator shared by minimax and perft: fills moves with the indices of the cards the player to move may play, */
+/* in the pov hand on the pov player's turn and otherwise in cards_remaining (less the pov hand and the card turned up */
+/* while it is in the stock), returns the number of moves */
+int legal_moves(game_state* position, int* moves){
+    int n = 0;
+    if(position->p.position == (position->starting+position->turn)%n_players){
+        for(int i = 0; i < n_hand; i++){
+            if(position->p.hand[i].value != -1){
+                moves[n++] = i;
+            }
+        }
+    }else{
+        int turned = (position->stock > 0) ? position->turned.suit*10 + position->turned.value : -1;
+        for(int i = 0; i < n_cards; i++){
+            card c = position->cards_remaining[i];
+            if(c.value != -1 && c.suit*10 + c.value != turned && contains(position->p.hand, n_hand, c) == -1){
+                moves[n++] = i;
+            }
+        }
+    }
+    return n;
+}
+
+/* Returns the card of move i (from legal_moves) in position */
+card move_card(game_state* position, int i){
+    if(position->p.position == (position->starting+position->turn)%n_players){
+        return position->p.hand[i];
+    }
+    return position->cards_remaining[i];
+}
+
+/* Sets new_position to position after move i (from legal_moves) is played, returns the depth new_position is searched to */
+/* when position is searched to depth: opponent plays use up one depth, pov plays are free */
+int play_move(game_state* position, int i, int depth, game_state* new_position){
+    cp_state(*position, new_position);
+    if(position->p.position == (position->starting+position->turn)%n_players){
+        play_card(new_position, position->p.hand[i]);
+        set_null(&new_position->p.hand[i]);
+        remove_remaining(new_position, position->p.hand[i]);
+        return depth;
+    }
+    play_card(new_position, position->cards_remaining[i]);
+    set_null(&new_position->cards_remaining[i]);
+    return depth - 1;
+}
+
+/* Collects the full table of position, the player who took it leads the next trick after every player draws from the stock */
+/* The pov player does not know what it draws, except the card turned up when it draws last, so its other draws stay null */
+void next_trick(game_state* position){
+    int index_highest = collect_table(position);
+    position->starting = (index_highest + position->starting) % n_players;
+    position->turn = 0;
+    if(position->stock > 0){
+        if(position->stock == n_players && (position->starting + n_players - 1) % n_players == position->p.position){
+            card null = {-1, -1};
+            cp_card(position->turned, &position->p.hand[contains(position->p.hand, n_hand, null)]);
+        }
+        position->stock -= n_players;
+    }
+}
+
+/* Returns 1 if searching position can not go on: the game is over, or the pov player is to play holding no known card */
+int search_over(game_state* position){
+    if(game_over(*position)){
+        return 1;
+    }
+    if(position->turn == n_players || position->p.position != (position->starting+position->turn)%n_players){
+        return 0;
+    }
+    for(int i = 0; i < n_hand; i++){
+        if(position->p.hand[i].value != -1){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Minimax algorithm to maximize or minimize (from param max) the evaluation at the depth given */
+/* Alpha-beta within the window alpha, beta: values inside it are exact, outside it only bound the exact value */
+int minimax(game_state* position, int max, int depth, int alpha, int beta){
+
+    if(depth <= 0 || search_over(position)){
+        collect_table(position);
+        return evaluation(*position);
+    }
+
+    int eval = max * -1000000;
+    if(position->turn < n_players){
+        search_cache* cache = get_cache();
+        unsigned long long key = position_key(position, max);
+        cache_entry* entry = &cache->entries[key & ((1 << cache_bits) - 1)];
+        int hint = -1;
+        if(entry->key == key){
+            hint = entry->best;
+            if(entry->depth >= depth){
+                if(entry->flag == cache_exact) return entry->value;
+                if(entry->flag == cache_lower && entry->value >= beta) return entry->value;
+                if(entry->flag == cache_upper && entry->value <= alpha) return entry->value;
+            }
+        }
+        int alpha_orig = alpha, beta_orig = beta;
+
+        int player = (position->starting+position->turn)%n_players;
+        int pov = (position->p.position == player);
+        int moves[n_cards];
+        int n = legal_moves(position, moves);
+        //The best move of an earlier search of this position is tried first
+        for(int m = 1; m < n; m++){
+            card c = move_card(position, moves[m]);
+            if(c.suit*10 + c.value == hint){
+                int t = moves[m]; moves[m] = moves[0]; moves[0] = t;
+            }
+        }
+
+        //Selective search tries opponent replies in order of how likely they are, hint first
+        if(!pov && selective_width > 0){
+            int score[n_cards];
+            for(int m = 0; m < n; m++){
+                card c = move_card(position, moves[m]);
+                score[m] = (c.suit*10 + c.value == hint) ? minimax_inf : reply_score(position, player, c);
+                for(int j = m; j > 0 && score[j] > score[j-1]; j--){
+                    int t = score[j]; score[j] = score[j-1]; score[j-1] = t;
+                    t = moves[j]; moves[j] = moves[j-1]; moves[j-1] = t;
+                }
+            }
+        }
+
+        int best = -1;
+        for(int m = 0; m < n && alpha < beta; m++){
+            game_state new_position;
+            int child_depth = play_move(position, moves[m], depth, &new_position);
+            int value;
+            if(!pov && selective_width > 0 && m >= selective_width && child_depth > 0){
+                //Late replies are searched one play shallower against the bound and fully only if they would change it
+                game_state reduced;
+                cp_state(new_position, &reduced);
+                if(max > 0){
+                    value = minimax(&reduced, position->partner_prob[player], child_depth-1, alpha, alpha+1);
+                }else{
+                    value = minimax(&reduced, position->partner_prob[player], child_depth-1, beta-1, beta);
+                }
+                if(max > 0 ? value > alpha : value < beta){
+                    value = minimax(&new_position, position->partner_prob[player], child_depth, alpha, beta);
+                }
+            }else{
+                value = minimax(&new_position, position->partner_prob[player], child_depth, alpha, beta);
+            }
+            if(search_stopped()){
+                return eval;
+            }
+            if(max > 0 ? value > eval : value < eval){
+                card c = move_card(position, moves[m]);
+                eval = value;
+                best = c.suit*10 + c.value;
+            }
+            if(max > 0){
+                alpha = MAX(alpha, eval);
+            }else{
+                beta = MIN(beta, eval);
+            }
+        }
+
+        //Other positions of older decisions and shallower searches are replaced, a deeper entry of the same position is kept
+        if((entry->key != key && entry->age != cache->age) || entry->depth <= depth){
+            entry->key = key;
+            entry->value = eval;
+            entry->depth = depth;
+            entry->flag = (eval <= alpha_orig) ? cache_upper : (eval >= beta_orig) ? cache_lower : cache_exact;
+            entry->best = (best != -1) ? best : hint;
+            entry->age = cache->age;
+        }
+        return eval;
+    }
+    next_trick(position);
+    return minimax(position, position->partner_prob[position->starting], depth, alpha, beta);
+}
+
+/* Counts the leaf nodes minimax reaches from position at the depth given, through the same legal_moves, play_move and next_trick */
+long long perft(game_state* position, int depth){
+
+    if(depth <= 0 || search_over(position)){
+        return 1;
+    }
+
+    long long nodes = 0;
+    if(position->turn < n_players){
+        int moves[n_cards];
+        int n = legal_moves(position, moves);
+        for(int m = 0; m < n; m++){
+            game_state new_position;
+            int child_depth = play_move(position, moves[m], depth, &new_position);
+            nodes += perft(&new_position, child_depth);
+        }
+        return nodes;
+    }
+    next_trick(position);
+    return perft(position, depth);
+}
+
+/* Opening lead table: one sorted 64 bit entry per key, the key in the low lead_key_bits bits and the canonical lead above them */
+/* The header names the build and search that wrote it, a table is only loaded by runs that would search the same leads */
+#define lead_magic 0x334C5242
+#define lead_key_bits 48
+
+typedef struct lead_header{
+    unsigned int magic;
+    unsigned int count;
+    unsigned int players;       //n_players of the build
+    unsigned int depth;         //search_depth of -x
+    unsigned int width;         //selective_width of -r
+    unsigned int unused;        //Keeps the entries after it 8 byte aligned
+} lead_header;
+
+const unsigned long long* lead_table = NULL;
+unsigned int lead_count = 0;
+long long lead_probes = 0;      //Opening leads looked up in the table
+long long lead_hits = 0;        //Opening leads found in it
+unsigned long long lead_hash = 0;   //FNV-1a hash of the whole lead table file, header included, 0 when none is loaded
+
+/* Returns 1 if the lead key only counts c among the low cards of its suit: the zero point briscole, and in the other suits */
+/* every card below the 3. The lowest of them stands for all in the table */
+int lead_merged(card c, int bris){
+    return c.value < (c.suit == bris ? 5 : 8);
+}
+
+/* Returns the lead table key of the opening lead of game, or 0 if game is not an opening lead or has no tabled role */
+/* The key keeps the point briscole and the carichi (3 and ace) of the other suits, and counts the low cards of every suit */
+/* (capped at 3 outside briscola). Suits are renamed so the key is shared by equivalent hands: bris becomes suit 0, the */
+/* others follow by descending key, perm receives the renaming */
+unsigned long long lead_key(game_state* game, int* perm){
+    if(game->num_cards_played != 0 || game->p.position != game->starting){
+        return 0;
+    }
+#if n_players == 5
+    //The caller leads the opening, a corp leader would have three partners and no single role
+    if(game->p.team < 0){
+        return 0;
+    }
+#endif
+    int field[4] = {0, 0, 0, 0};
+    int low[4] = {0, 0, 0, 0};
+    for(int i = 0; i < n_hand; i++){
+        card c = game->p.hand[i];
+        if(c.value == -1){
+            continue;
+        }
+        if(lead_merged(c, game->bris)){
+            low[c.suit]++;
+        }else{
+            field[c.suit] |= 1 << (c.value - 5);
+        }
+    }
+    for(int s = 0; s < 4; s++){
+        field[s] = (s == game->bris) ? (field[s] << 3) | low[s] : ((field[s] >> 3) << 2) | MIN(3, low[s]);
+    }
+    int order[3];
+    int n = 0;
+    for(int s = 0; s < 4; s++){
+        if(s != game->bris){
+            order[n] = s;
+            for(int j = n; j > 0 && field[order[j]] > field[order[j-1]]; j--){
+                int t = order[j]; order[j] = order[j-1]; order[j-1] = t;
+            }
+            n++;
+        }
+    }
+    perm[game->bris] = 0;
+    for(int k = 0; k < 3; k++){
+        perm[order[k]] = k + 1;
+    }
+
+    //Seat role: how many seats after the leader its one partner sits (the holder of the call in Chiamata, across the table with
+    //4 players), 0 when it plays alone, and the leader's team
+    int partner = 0;
+    for(int i = 1; i < n_players; i++){
+        if(game->partner_prob[(game->p.position + i) % n_players] == game->p.team){
+            partner = i;
+        }
+    }
+    unsigned long long key = field[game->bris];
+    for(int k = 0; k < 3; k++){
+        key |= (unsigned long long)field[order[k]] << (8 + 4*k);
+    }
+    key |= (unsigned long long)partner << 20;
+    key |= (unsigned long long)(game->p.team > 0) << 23;
+    //With a stock, the briscola turned up: its value if it has points, else 0
+    if(n_stock > 0 && game->turned.value != -1){
+        key |= (unsigned long long)(lead_merged(game->turned, game->bris) ? 0 : game->turned.value) << 24;
+    }
+    return key;
+}
+
+/* Returns the hand index of the opening lead stored in the lead table for game, or -1 if there is none */
+int lead_lookup(game_state* game){
+    int perm[4];
+    unsigned long long key;
+    if(lead_table == NULL || (key = lead_key(game, perm)) == 0){
+        return -1;
+    }
+    __atomic_fetch_add(&lead_probes, 1, __ATOMIC_RELAXED);
+    unsigned int lo = 0, hi = lead_count;
+    while(lo < hi){
+        unsigned int mid = lo + (hi - lo) / 2;
+        unsigned long long entry_key = lead_table[mid] & ((1ULL << lead_key_bits) - 1);
+        if(entry_key < key){
+            lo = mid + 1;
+        }else if(entry_key > key){
+            hi = mid;
+        }else{
+            //The lead is the card itself, or with value 0 the lowest merged card of its suit
+            int lead = lead_table[mid] >> lead_key_bits;
+            int index = -1;
+            for(int i = 0; i < n_hand; i++){
+                card c = game->p.hand[i];
+                if(c.value == -1 || perm[c.suit] != lead / 10){
+                    continue;
+                }
+                if(lead % 10 == 0 ? lead_merged(c, game->bris) && (index == -1 || c.value < game->p.hand[index].value) : c.value == lead % 10){
+                    index = i;
+                }
+            }
+            if(index != -1){
+                __atomic_fetch_add(&lead_hits, 1, __ATOMIC_RELAXED);
+            }
+            return index;
+        }
+    }
+    return -1;
+}
+
+/* When the user uses -l flag, maps the lead table file written by -g so make_decision consults it before searching */
+void load_lead_table(char* path){
+    off_t size;
+    const lead_header* header = (const lead_header*)map_file(path, &size);
+    if(size < sizeof(lead_header) || header->magic != lead_magic || size != sizeof(lead_header) + header->count * sizeof(unsigned long long)){
+        fprintf(stderr, "Error: %s is not a lead table.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if(header->players != n_players || header->depth != search_depth || header->width != selective_width){
+        fprintf(stderr, "Error: %s was generated for %u players at depth %u (-x) and width %u (-r), this run plays %d players at depth %d and width %d.\n",
+            path, header->players, header->depth, header->width, n_players, search_depth, selective_width);
+        exit(EXIT_FAILURE);
+    }
+    lead_table = (const unsigned long long*)(header + 1);
+    lead_count = header->count;
+    lead_hash = 0xCBF29CE484222325ULL;
+    for(off_t i = 0; i < size; i++){
+        lead_hash = (lead_hash ^ ((const unsigned char*)header)[i]) * 0x100000001B3ULL;
+    }
+}
+
+/* Given an evaluation array, returns the index of the best evaluation given if player is maximizing or minimizing */
+int index_to_play(int* eval_arr, player p){
+    int index = 0;
+    int eval = p.team * -1000000;
+    for(int i = 0; i < n_hand; i++){
+        if(p.hand[i].value != -1){
+            if(p.team > 0){
+                if(eval_arr[i] > eval){
+                    eval = eval_arr[i];
+                    index = i;
+                }
+            }else{
+                if(eval_arr[i] < eval){
+                    eval = eval_arr[i];
+                    index = i;
+                }
+            }
+        }
+    }
+    return index;
+}
+
+/* Given a game state, provides the maximal gain for pov player by evaluating each card in hand, returns the best evaluated card's index in hand */
+int make_decision(game_state game){
+    int lead = lead_lookup(&game);
+    if(lead != -1){
+        if(verbose) printf("Player %d leads %d%d from the lead table\n", game.p.position, game.p.hand[lead].value, game.p.hand[lead].suit);
+        return lead;
+    }
+
+    int eval_arr[n_hand];
+    //Only real decisions age the cache, the ponder thread's searches are all kept for the decision they lead to
+    if(search_stop == NULL){
+        get_cache()->age++;
+    }
+    for(int i = 0; i < n_hand; i++){
+        eval_arr[i] = game.p.team*-1000;
+    }
+
+    if(verbose){
+        printf("Player %d hand: ", game.p.position);
+        print_hand(game.p);
+    }
+
+    for(int i = 0; i < n_hand; i++){
+        if(game.p.hand[i].value != -1){
+            game_state new_position;
+            int depth = play_move(&game, i, search_depth, &new_position);
+            if(verbose) printf("trying card %d (%d%d)...", i, game.p.hand[i].value, game.p.hand[i].suit);
+            eval_arr[i] = minimax(&new_position, game.p.team, depth, -minimax_inf, minimax_inf);
+            if(search_stopped()){
+                break;
+            }
+            if(verbose) printf("eval of %d\n", eval_arr[i]);
+        }
+    }
+    return index_to_play(eval_arr, game.p);
+}
+
+#if n_players != 5
+/* Team of seat in the formats without a calling phase, partners sit across from each other */
+int seat_team(int seat){
+    return (seat % 2 == 0) ? 1 : -1;
+}
+#endif
+
+/* Runs the calling phase among bots, sets the team of the caller and partner in players and final_call, returns the caller */
+/* Without a calling phase, player 0 leads and the card turned up, the last of card_arr, names briscola */
+int bot_auction(card* card_arr, player* players, card* final_call){
+#if n_players != 5
+    for(int i = 0; i < n_players; i++){
+        players[i].team = seat_team(i);
+    }
+    cp_card(card_arr[n_cards-1], final_call);
+    return 0;
+#else
 
     int callers = n_players;
     int index = 0;
@@ -696,29 +1580,12 @@ int run_game(card* card_arr, player* players){
     while(callers > 1){
         int temp;
         if(players[index%n_players].calling > 0){
-            print_hand(players[index%n_players]);
-            printf("Player %d: ", index%n_players);
-            if(players[index%n_players].bot){
-                temp = call(players[index%n_players], calling_card);
-                printf("%d\n", temp);
-                if(temp == -1){
-                    players[index%n_players].calling = 0;
-                    callers--;
-                    index++;
-                    continue;
-                }
-            }else{
-                scanf("%d", &temp);
-                if(temp == -1){
-                    players[index%n_players].calling = 0;
-                    callers--;
-                    index++;
-                    continue;
-                }
-                if(!(temp < 9 && temp >= 0) || (temp > calling_card && calling_card != -1)){
-                    printf("Error: Invalid Call %d\n", temp);
-                    continue;
-                }
+            temp = call(players[index%n_players], calling_card);
+            if(temp == -1){
+                players[index%n_players].calling = 0;
+                callers--;
+                index++;
+                continue;
             }
         }else{
             index++;
@@ -728,140 +1595,2195 @@ int run_game(card* card_arr, player* players){
         calling_card = temp;
         index++;
     }
-
-    card final_call;
-    if(players[caller].bot){
-        final_call.value = calling_card;
-        final_call.suit = calling_suit(players[caller], -1);
-    }else{
-        int suit;
-        printf("Suit? ");
-        scanf("%d", &suit);
-        final_call.value = calling_card;
-        final_call.suit = suit;
+
+    final_call->value = calling_card;
+    final_call->suit = calling_suit(players[caller], -1);
+
+    players[caller].team = 1;
+    for(int i = 0; i < n_players; i++){
+        if(contains(players[i].hand, n_hand, *final_call) >= 0){
+            players[i].team = 1;
+            break;
+        }
+    }
+    return caller;
+#endif
+}
+
+/* When set, simulate appends every decision of its games to this file as "<final evaluation> <position string>" (see -y) */
+FILE* record_file = NULL;
+pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* When set, simulate plays the seats of duel_team (1 the caller's team, -1 the others) with these parameters instead of params (see -b) */
+eval_params* duel_params = NULL;
+int duel_team = 0;
+
+/* Given predefined arrays of cards and players, play game among bots, result (if not NULL) receives the call, teams and final evaluation */
+int simulate(card* card_arr, player* players, game_result* result){
+    char (*record)[position_string_len] = NULL;
+    if(record_file != NULL && (record = malloc(n_cards * position_string_len)) == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    card final_call;
+    int caller = bot_auction(card_arr, players, &final_call);
+#if n_players != 5
+    if(verbose) printf("Briscola is %d (turned up %d%d)\n\n", final_call.suit, final_call.value, final_call.suit);
+#else
+    if(verbose) printf("Final Caller: Player %d calls %d of %d\n\n", caller, final_call.value, final_call.suit);
+#endif
+
+    if(verbose){
+        for(int i = 0; i < n_players; i++){
+            printf("Player %d team is %d\n", i, players[i].team);
+        }
+        printf("\n");
+    }
+
+    game_state game;
+    setup_state(&game, card_arr, players, caller, final_call);
+    
+    int count = 0;
+    int play;
+    while(game.num_cards_played < n_cards){
+        if(count%n_players == 0 && game.num_cards_played > 0){
+            game.starting = (collect_table(&game) + game.starting) % n_players;
+            game.turn = 0;
+            next_state(&game, players, game.starting);
+            draw_cards(&game, players, card_arr);
+            if(verbose){
+                print_state(game);
+                printf("Current Evaluation: %d\n", evaluation(game));
+            }
+        }
+        if(game.num_cards_played == 0 && verbose){
+            print_state(game);
+        }
+        if(record != NULL){
+            position_string(game, record[game.num_cards_played]);
+        }
+        eval_params own = params;
+        if(duel_params != NULL && game.p.team == duel_team){
+            params = *duel_params;
+        }
+        play = make_decision(game);
+        params = own;
+        if(verbose) printf("Player %d plays %d%d\n", game.p.position, game.p.hand[play].value, game.p.hand[play].suit);
+        play_card(&game, game.p.hand[play]);
+        remove_remaining(&game, game.p.hand[play]);
+        set_null(&game.p.hand[play]);
+        next_state(&game, players, (game.p.position+1) % n_players);
+        count++;
+    }
+
+    collect_table(&game);
+    if(verbose){
+        print_state(game);
+        printf("Current Evaluation: %d\n", evaluation(game));
+    }
+
+    if(result != NULL){
+        result->caller = caller;
+        cp_card(final_call, &result->final_call);
+        for(int i = 0; i < n_players; i++){
+            result->team[i] = players[i].team;
+        }
+        result->eval = evaluation(game);
+    }
+
+    //Every position of the game is labelled with its final evaluation
+    if(record != NULL){
+        pthread_mutex_lock(&record_lock);
+        for(int i = 0; i < n_cards; i++){
+            fprintf(record_file, "%d %s\n", evaluation(game), record[i]);
+        }
+        pthread_mutex_unlock(&record_lock);
+        free(record);
+    }
+
+    return evaluation(game);
+}
+
+/* Plays card index play of the pov hand as run_game does, then hands the pov to the next player, collecting the table */
+/* and drawing from the stock of card_arr after the last card of a trick */
+void advance_game(game_state* game, player* players, card* card_arr, int play){
+    play_card(game, game->p.hand[play]);
+    remove_remaining(game, game->p.hand[play]);
+    set_null(&game->p.hand[play]);
+    next_state(game, players, (game->p.position+1) % n_players);
+    if(game->num_cards_played%n_players == 0 && game->num_cards_played < n_cards){
+        game->starting = (collect_table(game) + game->starting) % n_players;
+        game->turn = 0;
+        next_state(game, players, game->starting);
+        draw_cards(game, players, card_arr);
+    }
+}
+
+typedef struct ponder_job{
+    game_state game;
+    player players[n_players];
+    card card_arr[n_cards];
+    search_cache* cache;
+    int stop;
+    int running;
+    pthread_t thread;
+} ponder_job;
+
+/* Searches the next decision of a bot reachable from game, trying the plays of the humans to move first in order of how good they look to them */
+void ponder_line(game_state* game, player* players, card* card_arr){
+    if(search_stopped() || game->num_cards_played >= n_cards){
+        return;
+    }
+    if(game->p.bot){
+        make_decision(*game);
+        return;
+    }
+
+    int plays[n_hand];
+    int guess[n_hand];
+    int n = 0;
+    for(int i = 0; i < n_hand; i++){
+        if(game->p.hand[i].value != -1){
+            game_state next;
+            cp_state(*game, &next);
+            play_card(&next, game->p.hand[i]);
+            set_null(&next.p.hand[i]);
+            plays[n] = i;
+            guess[n] = game->p.team * evaluation(next);
+            for(int j = n; j > 0 && guess[j] > guess[j-1]; j--){
+                int t = guess[j]; guess[j] = guess[j-1]; guess[j-1] = t;
+                t = plays[j]; plays[j] = plays[j-1]; plays[j-1] = t;
+            }
+            n++;
+        }
+    }
+
+    for(int i = 0; i < n && !search_stopped(); i++){
+        game_state next;
+        player next_players[n_players];
+        cp_state(*game, &next);
+        next.p.bot = game->p.bot;
+        memcpy(next_players, players, sizeof(next_players));
+        advance_game(&next, next_players, card_arr, plays[i]);
+        ponder_line(&next, next_players, card_arr);
+    }
+}
+
+/* Worker for start_ponder, fills the shared cache with the searches of the next bot decision until stopped */
+void* ponder_worker(void* arg){
+    ponder_job* job = arg;
+    verbose = 0;
+    thread_cache = job->cache;
+    search_stop = &job->stop;
+    ponder_line(&job->game, job->players, job->card_arr);
+    thread_cache = NULL;
+    return NULL;
+}
+
+/* Starts searching the likely continuations of game, dealt from card_arr, in the background while a human chooses a card */
+void start_ponder(ponder_job* job, game_state* game, player* players, card* card_arr){
+    cp_state(*game, &job->game);
+    job->game.p.bot = game->p.bot;
+    memcpy(job->players, players, sizeof(job->players));
+    cp_set(card_arr, job->card_arr, n_cards);
+    job->cache = get_cache();
+    job->stop = 0;
+    job->running = (pthread_create(&job->thread, NULL, ponder_worker, job) == 0);
+}
+
+/* Cancels the background search and waits for it, everything it finished stays in the cache */
+void stop_ponder(ponder_job* job){
+    if(job->running){
+        __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+        pthread_join(job->thread, NULL);
+        job->running = 0;
+    }
+}
+
+/* Given predefined arrays of cards and players, play game with predetermined number of bots */
+int run_game(card* card_arr, player* players){
+
+#if n_players != 5
+    card final_call;
+    int caller = bot_auction(card_arr, players, &final_call);
+    printf("Briscola is %d (turned up %d%d)\n\n", final_call.suit, final_call.value, final_call.suit);
+#else
+    printf("Begin Calling Phase:\n"
+            "\tPlease enter a valid call (-1 to pass).\n");
+
+    int callers = n_players;
+    int index = 0;
+    int caller = -1;
+    int calling_card = -1;
+    while(callers > 1){
+        int temp;
+        if(players[index%n_players].calling > 0){
+            print_hand(players[index%n_players]);
+            printf("Player %d: ", index%n_players);
+            if(players[index%n_players].bot){
+                temp = call(players[index%n_players], calling_card);
+                printf("%d\n", temp);
+                if(temp == -1){
+                    players[index%n_players].calling = 0;
+                    callers--;
+                    index++;
+                    continue;
+                }
+            }else{
+                scanf("%d", &temp);
+                if(temp == -1){
+                    players[index%n_players].calling = 0;
+                    callers--;
+                    index++;
+                    continue;
+                }
+                if(!(temp < 9 && temp >= 0) || (temp > calling_card && calling_card != -1)){
+                    printf("Error: Invalid Call %d\n", temp);
+                    continue;
+                }
+            }
+        }else{
+            index++;
+            continue;
+        }
+        caller = index%n_players;
+        calling_card = temp;
+        index++;
+    }
+
+    card final_call;
+    if(players[caller].bot){
+        final_call.value = calling_card;
+        final_call.suit = calling_suit(players[caller], -1);
+    }else{
+        int suit;
+        printf("Suit? ");
+        scanf("%d", &suit);
+        final_call.value = calling_card;
+        final_call.suit = suit;
+    }
+    printf("Final Caller: Player %d calls %d of %d\n\n", caller, final_call.value, final_call.suit);
+
+    players[caller].team = 1;
+    for(int i = 0; i < n_players; i++){
+        if(contains(players[i].hand, n_hand, final_call) >= 0){
+            players[i].team = 1;
+            break;
+        }
+    }
+#endif
+
+    for(int i = 0; i < n_players; i++){
+        printf("Player %d team is %d\n", i, players[i].team);
+    }
+    printf("\n");
+
+    game_state game;
+    setup_state(&game, card_arr, players, caller, final_call);
+
+    int count = 0;
+    int play;
+    int play_index;
+    while(game.num_cards_played < n_cards){
+        if(count%n_players == 0 && game.num_cards_played > 0){
+            game.starting = (collect_table(&game) + game.starting) % n_players;
+            game.turn = 0;
+            next_state(&game, players, game.starting);
+            draw_cards(&game, players, card_arr);
+            print_state(game);
+            printf("Current Evaluation: %d\n", evaluation(game));
+        }
+
+        if(game.p.bot){
+            play = make_decision(game);
+        }else{
+            print_hand(game.p);
+            printf("Player %d? ", game.p.position);
+            fflush(stdout);
+            ponder_job ponder;
+            start_ponder(&ponder, &game, players, card_arr);
+            scanf("%d", &play);
+            stop_ponder(&ponder);
+            card c;
+            make_card(&c, play);
+            if((play_index = contains(game.p.hand, n_hand, c)) == -1){
+                printf("Error: Please play card from hand.");
+                continue;
+            }
+            play = play_index;
+        }
+        
+        printf("Player %d plays %d%d\n", game.p.position, game.p.hand[play].value, game.p.hand[play].suit);
+        play_card(&game, game.p.hand[play]);
+        remove_remaining(&game, game.p.hand[play]);
+        set_null(&game.p.hand[play]);
+        next_state(&game, players, (game.p.position+1) % n_players);
+        count++;
+    }
+
+    collect_table(&game);
+    print_state(game);
+    printf("Current Evaluation: %d\n", evaluation(game));
+
+    return evaluation(game);
+}
+
+/* When the user uses -m flag, allow the user to set the hands of each player (manual deal), the stock is dealt at random */
+int set_card_arr(card* card_arr){
+
+    printf("Please assign %d cards to each player (00 represents 2 of spades)\n"
+            "Ex. \"03 44 42 81 91 72 01 00\" is a valid hand of 8\n"
+            "Please input all %d cards per line.\n", n_hand, n_hand);
+
+    card buffer[n_cards];
+    init_set_null(buffer, n_cards);
+
+    int cards = 0;
+    int player = 0;
+    char* delim = " ";
+    char* scan_buffer = NULL;
+    int hand_arr[n_hand];
+    size_t size = 0;
+    size_t len = 0;
+    
+    loop:
+    while(cards < n_players*n_hand){
+
+        printf("Assign cards to player %d:\n", player);
+        if( (len = read_line(&scan_buffer, &size, stdin)) != -1){
+            int n = 0;
+            char* buf = strtok(scan_buffer, delim);
+            while(buf != NULL && n < n_hand){
+                hand_arr[n] = atoi(buf);
+                buf = strtok(NULL, delim);
+                n++;
+            }
+            for(int i = 0; i < n_hand; i++){
+                card c;
+                make_card(&c, hand_arr[i]);
+                if(contains(card_arr, n_cards, c) == -1 || contains(buffer, n_cards, c) >= 0){
+                    printf("Error: Invalid Card Entry %d%d\n", c.value, c.suit);
+                    goto loop;
+                }
+            }
+            for(int i = 0; i < n_hand; i++){
+                card c;
+                c.value = hand_arr[i]/10;
+                c.suit = hand_arr[i]%10;
+                cp_card(c, &buffer[i+cards]);
+            }
+        }else{
+            perror("read_line");
+            exit(EXIT_FAILURE);
+        }
+
+        cards+=n_hand;
+        player++;
+    }
+    if(n_stock > 0){
+        shuffle_card_arr(card_arr, n_cards);
+        for(int i = 0; i < n_cards; i++){
+            if(contains(buffer, cards, card_arr[i]) == -1){
+                cp_card(card_arr[i], &buffer[cards++]);
+            }
+        }
+    }
+    cp_set(buffer, card_arr, n_cards);
+    free(scan_buffer);
+}
+
+/* When the user uses -a flag, runs make_decision on the position string str and reports the chosen card and search time */
+int analyze(char* str){
+    game_state position;
+    if(parse_position(str, &position) == -1){
+        fprintf(stderr, "Error: Invalid position string \"%s\"\n", str);
+        exit(EXIT_FAILURE);
+    }
+    if(position.p.position != (position.starting + position.turn) % n_players){
+        fprintf(stderr, "Error: Position is not the pov player's turn\n");
+        exit(EXIT_FAILURE);
+    }
+    print_state(position);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int play = make_decision(position);
+    double seconds = elapsed(start);
+    printf("Best card: %d%d (searched in %.3fs)\n", position.p.hand[play].value, position.p.hand[play].suit, seconds);
+    return play;
+}
+
+#define perft_max_depth 4
+
+typedef struct perft_entry{
+    const char* position;
+    long long nodes[perft_max_depth];
+} perft_entry;
+
+/* Known-good leaf counts of the minimax move generator at depths 1 to perft_max_depth, any rewrite of the generator must match them */
+const perft_entry perft_table[] = {
+#if n_players == 5
+    //Opening lead by the caller
+    {"1 9123013041523151 - ---------- -/-/-/-/- 1 0 1 ++---", {256, 7936, 238080, 6904320}},
+    //Pov plays third in the first trick
+    {"1 9123013041523151 0233 0233------ -/-/-/-/- 4 2 1 ++---", {240, 6960, 866208, 23387616}},
+    //Pov plays last, every branch rolls the trick over through collect_table
+    {"1 9123013041523151 02334263 02334263-- -/-/-/-/- 2 4 1 ++---", {1232, 33264, 1100736, 27518400}},
+    //Pov leads the last trick
+    {"0 --------------83 6190917043117192934082322003330151025253802250136021626341127310313072 ---------- 015102525321626341127310313072/8232200333/1171929340/8022501360/6190917043 0 0 3 +---+", {4, 12, 24, 24}},
+#elif n_players == 4
+    //Opening lead, 61 turned up
+    {"0 911142 - -------- -/-/-/- 0 0 1 +-+- 61", {108, 3780, 128520, 6859512}},
+    //Pov plays third in the first trick
+    {"2 911142 0233 0233---- -/-/-/- 0 2 1 +-+- 61", {102, 6138, 196416, 6088896}},
+    //Pov leads the trick before the last draw, it draws the turned up 00 when seat 1 takes the trick
+    {"0 923280 634121204330701183100203523122902373918113535082 -------- 13535082/4330701152312290/8310020323739181/63412120 0 0 0 +-+- 00", {36, 396, 3960, 61530}},
+#else
+    //Opening lead, 61 turned up
+    {"0 911142 - ---- -/- 0 0 1 +- 61", {108, 6930, 257040, 1758480}},
+    //Pov replies in the first trick, lines end once its known cards run out
+    {"1 911142 02 02-- -/- 0 1 1 +- 61", {210, 7140, 50148, 50148}},
+    //Pov leads the trick before the last draw, it draws the turned up 61 when it loses the trick
+    {"1 219142 5001106011827141511340730022205231126290438123630383938033530292 ---- 10601182714151134073002220523112629023633353/50014381038393800292 1 0 1 +- 61", {12, 91, 300, 369}},
+#endif
+};
+
+/* Runs perft from position at depths 1 through depth, printing nodes and nodes/sec, checked against expected when not NULL */
+/* Returns the number of depths whose count differs from expected */
+int perft_report(game_state position, int depth, const long long* expected){
+    int mismatches = 0;
+    for(int d = 1; d <= depth; d++){
+        game_state root;
+        cp_state(position, &root);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        long long nodes = perft(&root, d);
+        double seconds = elapsed(start);
+        printf("  depth %d: %12lld nodes %12.0f nodes/sec", d, nodes, seconds > 0 ? nodes / seconds : 0);
+        if(expected != NULL && d <= perft_max_depth){
+            if(nodes == expected[d-1]){
+                printf("  ok");
+            }else{
+                printf("  MISMATCH (expected %lld)", expected[d-1]);
+                mismatches++;
+            }
+        }
+        printf("\n");
+    }
+    return mismatches;
+}
+
+/* When the user uses -n flag, runs perft to depth on every perft_table position, or only on str when given with -a */
+/* Returns the number of mismatched counts */
+int run_perft(int depth, char* str){
+    game_state position;
+    if(str != NULL){
+        if(parse_position(str, &position) == -1){
+            fprintf(stderr, "Error: Invalid position string \"%s\"\n", str);
+            exit(EXIT_FAILURE);
+        }
+        printf("Perft %s\n", str);
+        return perft_report(position, depth, NULL);
+    }
+
+    int mismatches = 0;
+    for(int i = 0; i < sizeof(perft_table)/sizeof(perft_table[0]); i++){
+        if(parse_position(perft_table[i].position, &position) == -1){
+            fprintf(stderr, "Error: Invalid perft position \"%s\"\n", perft_table[i].position);
+            exit(EXIT_FAILURE);
+        }
+        printf("Perft %s\n", perft_table[i].position);
+        mismatches += perft_report(position, depth, perft_table[i].nodes);
+    }
+    printf("%s\n", mismatches == 0 ? "Perft: all counts match" : "Perft: MISMATCHED counts");
+    return mismatches;
+}
+
+/* Parses one line of a deal file at *cursor (never reading past end) into card_arr, advancing *cursor to the next line */
+/* A deal line holds n_cards two digit cards (00 represents 2 of spades), the first n_hand go to player 0, so on, the rest is the stock */
+/* Returns 1 if a deal was read, 0 for blank or '#' comment lines, -1 if the line is not a valid deal */
+int parse_deal(const char** cursor, const char* end, card* card_arr){
+    const char* p = *cursor;
+    const char* eol = memchr(p, '\n', end - p);
+    if(eol == NULL){
+        eol = end;
+    }
+    *cursor = (eol < end) ? eol + 1 : end;
+
+    int seen[n_cards] = {0};
+    int n = 0;
+    while(p < eol){
+        if(*p == ' ' || *p == '\t' || *p == '\r' || *p == ','){
+            p++;
+            continue;
+        }
+        if(*p == '#'){
+            break;
+        }
+        if(eol - p < 2 || *p < '0' || *p > '9' || p[1] < '0' || p[1] > '3' || n >= n_cards){
+            return -1;
+        }
+        int value = *p - '0';
+        int suit = p[1] - '0';
+        if(seen[suit*10 + value]){
+            return -1;
+        }
+        seen[suit*10 + value] = 1;
+        card_arr[n].value = value;
+        card_arr[n].suit = suit;
+        n++;
+        p += 2;
+    }
+    if(n == 0){
+        return 0;
+    }
+    return (n == n_cards) ? 1 : -1;
+}
+
+typedef struct batch_job{
+    card* deals;
+    game_result* results;
+    int n_deals;
+} batch_job;
+
+/* Item of run_batch, simulates deal among bots */
+void batch_deal(void* arg, int deal){
+    batch_job* job = arg;
+    card card_arr[n_cards];
+    player players[n_players];
+    cp_set(&job->deals[deal*n_cards], card_arr, n_cards);
+    init_players(players, n_players, card_arr);
+    simulate(card_arr, players, &job->results[deal]);
+}
+
+/* When the user uses -f flag, simulates every deal in the deal file on all cores and writes one result line per deal to out */
+int run_batch(char* path, FILE* out){
+
+    off_t size;
+    const char* text = map_file(path, &size);
+    if(text == NULL){
+        fprintf(stderr, "Error: Deal file %s is empty.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    //A deal needs at least 2 characters per card, which bounds the number of deals in the file
+    const char* end = text + size;
+    int max_deals = size / (2*n_cards) + 1;
+    batch_job job;
+    job.deals = malloc(sizeof(card) * n_cards * max_deals);
+    job.n_deals = 0;
+    if(job.deals == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    const char* cursor = text;
+    int line = 0;
+    while(cursor < end){
+        line++;
+        int status = parse_deal(&cursor, end, &job.deals[job.n_deals*n_cards]);
+        if(status == -1){
+            fprintf(stderr, "Error: Invalid deal on line %d of %s\n", line, path);
+            exit(EXIT_FAILURE);
+        }
+        job.n_deals += status;
+    }
+    munmap((void*)text, size);
+
+    job.results = malloc(sizeof(game_result) * (job.n_deals + 1));
+    if(job.results == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    run_parallel(batch_deal, &job, job.n_deals);
+
+    float avg = 0;
+    fprintf(out, "# deal caller call teams eval\n");
+    for(int i = 0; i < job.n_deals; i++){
+        game_result* r = &job.results[i];
+        fprintf(out, "%d %d %d%d ", i, r->caller, r->final_call.value, r->final_call.suit);
+        for(int j = 0; j < n_players; j++){
+            fprintf(out, "%c", r->team[j] > 0 ? '+' : '-');
+        }
+        fprintf(out, " %d\n", r->eval);
+        avg += r->eval;
+    }
+    if(job.n_deals > 0){
+        printf("Average Evaluation over %d deals: %f\n", job.n_deals, avg/job.n_deals);
+    }
+
+    free(job.results);
+    free(job.deals);
+    return job.n_deals;
+}
+
+/* Streaming statistics of the final evaluations of simulated games, updated one game at a time (Welford's method) */
+#define stats_bins 12
+#define stats_min_games 10
+#define stats_report_seconds 10
+
+/* Total points of the 40 cards */
+#define n_points 120
+
+typedef struct game_stats{
+    long long games;
+    double mean;
+    double m2;
+    long long wins;                     //Games won by the caller's team
+    long long draws;
+    long long calls[n_players];         //Games called by each seat
+    long long seat_wins[n_players];     //Games won by the team of each seat
+    long long histogram[stats_bins];    //Final evaluations in bins of 2*n_points/stats_bins from -n_points
+} game_stats;
+
+/* Adds the result of one game to stats */
+void stats_add(game_stats* stats, game_result* result){
+    stats->games++;
+    double delta = result->eval - stats->mean;
+    stats->mean += delta / stats->games;
+    stats->m2 += delta * (result->eval - stats->mean);
+
+    if(result->eval > 0){
+        stats->wins++;
+    }else if(result->eval == 0){
+        stats->draws++;
+    }
+    stats->calls[result->caller]++;
+    for(int i = 0; i < n_players; i++){
+        if(result->team[i] * result->eval > 0){
+            stats->seat_wins[i]++;
+        }
+    }
+    int bin = (result->eval + n_points) * stats_bins / (2*n_points);
+    stats->histogram[MAX(0, MIN(bin, stats_bins - 1))]++;
+}
+
+/* Returns the sample standard deviation of the evaluations */
+double stats_sd(game_stats* stats){
+    return stats->games > 1 ? sqrt(stats->m2 / (stats->games - 1)) : 0;
+}
+
+/* Returns the half width of the 95% confidence interval of the mean evaluation */
+double stats_ci(game_stats* stats){
+    return stats->games > 1 ? 1.96 * stats_sd(stats) / sqrt(stats->games) : INFINITY;
+}
+
+/* Prints a one line progress report */
+void stats_progress(game_stats* stats, double seconds){
+    printf("Progress: %lld games in %.0fs, mean %+.2f +/- %.2f, caller team wins %.1f%%\n", stats->games, seconds,
+        stats->mean, stats_ci(stats), 100.0 * stats->wins / stats->games);
+    fflush(stdout);
+}
+
+/* Prints the full summary of stats */
+void stats_report(game_stats* stats){
+    if(stats->games == 0){
+        return;
+    }
+    printf("Games: %lld, mean %+.2f, sd %.2f, 95%% confidence +/- %.2f\n", stats->games, stats->mean, stats_sd(stats), stats_ci(stats));
+    printf("Caller team wins %.1f%%, draws %.1f%%\n", 100.0 * stats->wins / stats->games, 100.0 * stats->draws / stats->games);
+    printf("Seat  called  team won\n");
+    for(int i = 0; i < n_players; i++){
+        printf("%4d  %5.1f%%  %7.1f%%\n", i, 100.0 * stats->calls[i] / stats->games, 100.0 * stats->seat_wins[i] / stats->games);
+    }
+    printf("Evaluation histogram:\n");
+    long long most = 1;
+    for(int b = 0; b < stats_bins; b++){
+        most = MAX(most, stats->histogram[b]);
+    }
+    for(int b = 0; b < stats_bins; b++){
+        int low = -n_points + b * 2*n_points / stats_bins;
+        int high = low + 2*n_points / stats_bins;
+        printf("  [%4d, %4d%c %8lld ", low, high, b == stats_bins - 1 ? ']' : ')', stats->histogram[b]);
+        for(int i = 0; i < 40 * stats->histogram[b] / most; i++){
+            printf("#");
+        }
+        printf("\n");
+    }
+}
+
+/* When the user uses -b flag, plays count random deals among bots twice: first the caller's team plays the parameters in path and */
+/* the other seats the current ones, then the other way round. Both games have the same auction, which uses the current parameters */
+/* Prints the points per game the parameters in path gain over the current ones (named current), with the confidence of the mean, and returns it */
+double run_duel(int count, char* path, char* current){
+    eval_params challenger = params;
+    load_params(path, &challenger);
+    duel_params = &challenger;
+    verbose = 0;
+
+    long long deals = 0, won = 0, lost = 0;
+    double mean = 0, m2 = 0, with = 0, against = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    double last_report = 0;
+    while(deals < count){
+        card card_arr[n_cards];
+        for(int i = 0; i < n_cards; i++){
+            card_arr[i].value = i%10;
+            card_arr[i].suit = i/10;
+        }
+        shuffle_card_arr(card_arr, n_cards);
+
+        int eval[2];
+        for(int side = 0; side < 2; side++){
+            player players[n_players];
+            game_result result;
+            init_players(players, n_players, card_arr);
+            duel_team = side == 0 ? 1 : -1;
+            free_cache();
+            simulate(card_arr, players, &result);
+            eval[side] = result.eval;
+        }
+        //Points the challenger's side took minus the current side's, halved to one game
+        double gain = (eval[0] - eval[1]) / 2.0;
+        deals++;
+        double delta = gain - mean;
+        mean += delta / deals;
+        m2 += delta * (gain - mean);
+        won += gain > 0;
+        lost += gain < 0;
+        with += eval[0];
+        against += eval[1];
+
+        double seconds = elapsed(start);
+        if(seconds - last_report >= stats_report_seconds && deals < count){
+            printf("Progress: %lld deals in %.0fs, %s gains %+.2f points per game\n", deals, seconds, path, mean);
+            fflush(stdout);
+            last_report = seconds;
+        }
+    }
+    duel_params = NULL;
+
+    double ci = deals > 1 ? 1.96 * sqrt(m2 / (deals - 1)) / sqrt(deals) : INFINITY;
+    printf("Duel over %lld deals, each played both ways round: %s gains %+.2f +/- %.2f points per game over the %s parameters\n",
+        deals, path, mean, ci, current);
+    printf("Deals won %lld, lost %lld, tied %lld; caller's team %+.2f playing %s, %+.2f against it\n",
+        won, lost, deals - won - lost, with / deals, path, against / deals);
+    return mean;
+}
+
+/* Checkpoint of a -s run: the settings it was started with and everything the remaining games depend on */
+/* The search caches are not saved, each game starts with an empty cache so its play never depends on earlier games */
+#define checkpoint_magic 0x4B434252
+#define checkpoint_seconds 30
+
+typedef struct checkpoint{
+    unsigned int magic;
+    int players;
+    int depth;
+    int width;
+    int simulation_count;
+    double ci_width;
+    eval_params params;
+    unsigned long long lead_hash;   //Lead table of -l (see lead_hash), 0 without one
+    long long lead_probes;
+    long long lead_hits;
+    unsigned long long rng;
+    card card_arr[n_cards];     //Deal of the next game
+    game_stats stats;
+    long long record_offset;    //Length of the -y record file once the saved games were recorded, -1 without one
+} checkpoint;
+
+/* Writes ck to a temporary file renamed over path, so an interrupted write never leaves a partial checkpoint */
+void save_checkpoint(char* path, checkpoint* ck){
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* f = fopen(tmp, "wb");
+    if(f == NULL || fwrite(ck, sizeof(*ck), 1, f) != 1 || fflush(f) != 0 || fsync(fileno(f)) != 0 || fclose(f) != 0 || rename(tmp, path) != 0){
+        perror(tmp);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Writes out the games recorded so far and returns the length of the record file, for the checkpoint saved after them */
+long long record_length(void){
+    if(fflush(record_file) != 0 || fsync(fileno(record_file)) != 0){
+        perror("record file");
+        exit(EXIT_FAILURE);
+    }
+    return lseek(fileno(record_file), 0, SEEK_END);
+}
+
+/* Replaces ck with the checkpoint at path if there is one, returns 1 if it was loaded and 0 if path does not exist yet */
+int load_checkpoint(char* path, checkpoint* ck){
+    FILE* f = fopen(path, "rb");
+    if(f == NULL){
+        if(errno == ENOENT){
+            return 0;
+        }
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    checkpoint saved;
+    size_t n = fread(&saved, sizeof(saved), 1, f);
+    fclose(f);
+    if(n != 1 || saved.magic != checkpoint_magic){
+        fprintf(stderr, "Error: %s is not a checkpoint.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if(saved.players != ck->players || saved.depth != ck->depth || saved.width != ck->width
+            || saved.simulation_count != ck->simulation_count || saved.ci_width != ck->ci_width
+            || memcmp(&saved.params, &ck->params, sizeof(eval_params)) != 0){
+        fprintf(stderr, "Error: Checkpoint %s was written by a run with different settings.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if(saved.lead_hash != ck->lead_hash){
+        fprintf(stderr, "Error: Checkpoint %s was written by a run with %s (-l).\n", path,
+            saved.lead_hash == 0 ? "no lead table" : (ck->lead_hash == 0 ? "a lead table" : "a different lead table"));
+        exit(EXIT_FAILURE);
+    }
+    if((saved.record_offset < 0) != (ck->record_offset < 0)){
+        fprintf(stderr, "Error: Checkpoint %s was written by a run with %s (-y).\n", path, saved.record_offset < 0 ? "no record file" : "a record file");
+        exit(EXIT_FAILURE);
+    }
+    *ck = saved;
+    return 1;
+}
+
+typedef struct lead_job{
+    game_state* games;
+    unsigned long long* entries;
+    int n_games;
+} lead_job;
+
+typedef struct lead_order{
+    unsigned long long key;
+    int game;
+} lead_order;
+
+/* Orders lead_order items by key */
+int compare_lead_order(const void* a, const void* b){
+    unsigned long long x = ((const lead_order*)a)->key, y = ((const lead_order*)b)->key;
+    return (x > y) - (x < y);
+}
+
+/* Item of run_lead_table, searches the lead of opening g */
+void lead_opening(void* arg, int g){
+    lead_job* job = arg;
+    game_state* game = &job->games[g];
+    int perm[4];
+    unsigned long long key = lead_key(game, perm);
+    card c = game->p.hand[make_decision(*game)];
+    int value = lead_merged(c, game->bris) ? 0 : c.value;
+    job->entries[g] = key | (unsigned long long)(perm[c.suit]*10 + value) << lead_key_bits;
+}
+
+/* When the user uses -g flag, searches the opening lead of count random deals bid by bots on all cores and writes the lead table to path */
+/* Openings with the same key are searched once, returns the number of entries written */
+int run_lead_table(int count, char* path){
+    if(path == NULL){
+        fprintf(stderr, "Error: The lead table needs an output file (-o).\n");
+        exit(EXIT_FAILURE);
+    }
+    lead_job job;
+    lead_order* order = malloc(sizeof(lead_order) * count);
+    game_state* games = malloc(sizeof(game_state) * count);
+    job.games = malloc(sizeof(game_state) * count);
+    job.entries = malloc(sizeof(unsigned long long) * count);
+    if(order == NULL || games == NULL || job.games == NULL || job.entries == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned int seed = time(NULL);
+    for(int i = 0; i < count; i++){
+        card card_arr[n_cards];
+        for(int k = 0; k < n_cards; k++){
+            card_arr[k].value = k%10;
+            card_arr[k].suit = k/10;
+        }
+        for(int k = n_cards - 1; k > 0; k--){
+            int j = rand_r(&seed) % (k + 1);
+            card temp = card_arr[k];
+            card_arr[k] = card_arr[j];
+            card_arr[j] = temp;
+        }
+        player players[n_players];
+        card final_call;
+        init_players(players, n_players, card_arr);
+        int caller = bot_auction(card_arr, players, &final_call);
+        setup_state(&games[i], card_arr, players, caller, final_call);
+        int perm[4];
+        order[i].key = lead_key(&games[i], perm);
+        order[i].game = i;
+    }
+    qsort(order, count, sizeof(lead_order), compare_lead_order);
+    job.n_games = 0;
+    for(int i = 0; i < count; i++){
+        if(i == 0 || order[i].key != order[i-1].key){
+            job.games[job.n_games++] = games[order[i].game];
+        }
+    }
+    free(games);
+    free(order);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_parallel(lead_opening, &job, job.n_games);
+    double seconds = elapsed(start);
+
+    //Games were taken in key order, so the entries are already sorted for lead_lookup
+    lead_header header = {lead_magic, job.n_games, n_players, search_depth, selective_width, 0};
+    FILE* out = fopen(path, "wb");
+    if(out == NULL){
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    if(fwrite(&header, sizeof(header), 1, out) != 1 || fwrite(job.entries, sizeof(unsigned long long), job.n_games, out) != job.n_games || fclose(out) != 0){
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    printf("Lead table: %d openings (%d repeated keys) searched at depth %d in %.1fs, written to %s\n", job.n_games, count - job.n_games, search_depth, seconds, path);
+
+    free(job.games);
+    free(job.entries);
+    return job.n_games;
+}
+
+/* Evaluation tuning: evaluation is linear in taken, weight, bris and held, so they are fit to the final evaluation of recorded games by least squares */
+/* Unknown k: 0 is taken, 1 + cards played is weight, tune_dim - 2 is bris, tune_dim - 1 is held */
+/* The calling weights (relative_value, call_limit) are not fit: records only show how the winning raise of each auction played */
+/* out under the current weights, other weights move the call to bids the records never saw, so a fit to them misjudges play */
+#define tune_dim (n_cards + 4)
+#define tune_ridge 1e-4
+#define tune_slice_bytes (1 << 20)
+
+typedef struct tune_job{
+    const char* text;
+    const char* end;
+    int n_slices;
+    double gram[tune_dim][tune_dim];    //Sum of x x^T over the positions
+    double target[tune_dim];            //Sum of x y
+    double yy;                          //Sum of y^2
+    long long positions;
+    long long invalid;
+    pthread_mutex_t lock;
+} tune_job;
+
+/* Item of run_tune, accumulates the normal equations of the records in slice index of the file, lines belong to the slice they start in */
+void tune_slice(void* arg, int index){
+    tune_job* job = arg;
+    long long size = job->end - job->text;
+    const char* p = job->text + size * index / job->n_slices;
+    const char* stop = job->text + size * (index + 1) / job->n_slices;
+    if(p > job->text && p[-1] != '\n'){
+        while(p < job->end && *p++ != '\n');
+    }
+
+    double gram[tune_dim][tune_dim] = {{0}};
+    double target[tune_dim] = {0};
+    double yy = 0;
+    long long positions = 0, invalid = 0;
+    char line[position_string_len + 16];
+    while(p < stop){
+        const char* eol = memchr(p, '\n', job->end - p);
+        if(eol == NULL){
+            eol = job->end;
+        }
+        int len = eol - p;
+        if(len > 0 && p[0] != '#'){
+            game_state position;
+            char* rest;
+            if(len >= sizeof(line)){
+                invalid++;
+            }else{
+                memcpy(line, p, len);
+                line[len] = '\0';
+                long y = strtol(line, &rest, 10);
+                if(rest == line || *rest != ' ' || parse_position(rest + 1, &position) == -1 || position.num_cards_played >= n_cards){
+                    invalid++;
+                }else{
+                    int f[4];
+                    eval_features(&position, f);
+                    int k[4] = {0, 1 + position.num_cards_played, tune_dim - 2, tune_dim - 1};
+                    for(int a = 0; a < 4; a++){
+                        for(int b = 0; b < 4; b++){
+                            gram[k[a]][k[b]] += (double)f[a] * f[b];
+                        }
+                        target[k[a]] += (double)f[a] * y;
+                    }
+                    yy += (double)y * y;
+                    positions++;
+                }
+            }
+        }
+        p = eol + 1;
+    }
+
+    pthread_mutex_lock(&job->lock);
+    for(int a = 0; a < tune_dim; a++){
+        for(int b = 0; b < tune_dim; b++){
+            job->gram[a][b] += gram[a][b];
+        }
+        job->target[a] += target[a];
+    }
+    job->yy += yy;
+    job->positions += positions;
+    job->invalid += invalid;
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* Returns the root mean square error of evaluating the tuned positions with the weights theta (in points, not eval_scale units) */
+double tune_error(tune_job* job, double* theta){
+    double sse = job->yy;
+    for(int a = 0; a < tune_dim; a++){
+        sse -= 2 * theta[a] * job->target[a];
+        for(int b = 0; b < tune_dim; b++){
+            sse += theta[a] * job->gram[a][b] * theta[b];
+        }
+    }
+    return sqrt(MAX(sse, 0) / job->positions);
+}
+
+/* Writes the weights of p into theta, in points */
+void params_to_theta(eval_params* p, double* theta){
+    theta[0] = (double)p->taken / eval_scale;
+    for(int i = 0; i <= n_cards; i++){
+        theta[1 + i] = (double)p->weight[i] / eval_scale;
+    }
+    theta[tune_dim - 2] = (double)p->bris / eval_scale;
+    theta[tune_dim - 1] = (double)p->held / eval_scale;
+}
+
+/* When the user uses -t flag, fits the evaluation weights to the records in path (written by -y) on all cores and writes the parameter file to out */
+/* Weights are pulled towards the current parameters (ridge), so weights with no records to fit keep their value */
+int run_tune(char* path, FILE* out){
+    off_t size;
+    const char* text = map_file(path, &size);
+    if(text == NULL){
+        fprintf(stderr, "Error: Record file %s is empty.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    tune_job* job = calloc(1, sizeof(tune_job));
+    if(job == NULL){
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    job->text = text;
+    job->end = text + size;
+    job->n_slices = size / tune_slice_bytes + 1;
+    pthread_mutex_init(&job->lock, NULL);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_parallel(tune_slice, job, job->n_slices);
+    munmap((void*)text, size);
+    if(job->invalid > 0 || job->positions == 0){
+        fprintf(stderr, "Error: %lld invalid records and %lld positions in %s\n", job->invalid, job->positions, path);
+        exit(EXIT_FAILURE);
+    }
+
+    //Solve (G + ridge) theta = t + ridge theta0 by Gaussian elimination with partial pivoting
+    double theta0[tune_dim], theta[tune_dim];
+    double m[tune_dim][tune_dim + 1];
+    params_to_theta(&params, theta0);
+    for(int a = 0; a < tune_dim; a++){
+        double ridge = tune_ridge * job->gram[a][a] + 1e-9;
+        for(int b = 0; b < tune_dim; b++){
+            m[a][b] = job->gram[a][b];
+        }
+        m[a][a] += ridge;
+        m[a][tune_dim] = job->target[a] + ridge * theta0[a];
+    }
+    for(int c = 0; c < tune_dim; c++){
+        int pivot = c;
+        for(int r = c + 1; r < tune_dim; r++){
+            if(fabs(m[r][c]) > fabs(m[pivot][c])) pivot = r;
+        }
+        for(int b = 0; b <= tune_dim; b++){
+            double t = m[c][b]; m[c][b] = m[pivot][b]; m[pivot][b] = t;
+        }
+        for(int r = 0; r < tune_dim; r++){
+            if(r != c && m[r][c] != 0){
+                double factor = m[r][c] / m[c][c];
+                for(int b = c; b <= tune_dim; b++){
+                    m[r][b] -= factor * m[c][b];
+                }
+            }
+        }
+    }
+
+    eval_params tuned = params;
+    tuned.taken = lround(m[0][tune_dim] / m[0][0] * eval_scale);
+    for(int i = 0; i <= n_cards; i++){
+        tuned.weight[i] = lround(m[1 + i][tune_dim] / m[1 + i][1 + i] * eval_scale);
+    }
+    tuned.bris = lround(m[tune_dim - 2][tune_dim] / m[tune_dim - 2][tune_dim - 2] * eval_scale);
+    tuned.held = lround(m[tune_dim - 1][tune_dim] / m[tune_dim - 1][tune_dim - 1] * eval_scale);
+    params_to_theta(&tuned, theta);
+    double seconds = elapsed(start);
+
+    write_params(out, &tuned);
+    fprintf(stderr, "Tuned on %lld positions in %.1fs: rms error %.2f before, %.2f after\n",
+        job->positions, seconds, tune_error(job, theta0), tune_error(job, theta));
+    fprintf(stderr, "Calling weights (relative_value, call_limit) are written unchanged, records cannot fit them\n");
+    fprintf(stderr, "The fit predicts final evaluations, check that it plays better than the current parameters with -s <deals> -b <file>\n");
+
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+    return 0;
+}
+
+/* Double dummy analysis: every hand is known to every seat, hands are masks with bit suit*10+value set for each card held */
+#define dd_table_bits 24
+#define dd_card(bit) ((card){(bit)%10, (bit)/10})
+
+typedef struct dd_search{
+    unsigned long long hand[n_players];
+    int team[n_players];
+    int bris;
+    int tabled[n_players];
+    unsigned long long table_mask;
+    int stock[n_stock + 1];         //Stock in draw order, the last card turned up
+    int drawn;                      //Cards drawn from the stock so far
+    unsigned long long stock_mask;  //Cards still in the stock
+    unsigned long long key;         //Zobrist key of the hands, dd_zobrist of every card held by its holder and dd_zobrist_drawn of every round drawn
+    long long nodes;
+} dd_search;
+
+/* Transposition table shared by every solver thread, keyed by the hands and leader at the start of a trick, in buckets of two entries: */
+/* the first keeps the entry with the most cards left, the second the latest. Each entry packs lower bound in bits 0-6, */
+/* upper bound in bits 7-13, the best lead found (card bit + 1, 0 if none) in bits 14-19, tricks left (at most 15) */
+/* in bits 20-23 and the high 40 bits of the key above them */
+unsigned long long* dd_table;
+unsigned long long dd_zobrist[n_players][n_cards];
+unsigned long long dd_zobrist_leader[n_players];
+unsigned long long dd_zobrist_drawn[n_stock/n_players + 1];
+
+#define dd_lock(data) ((data) >> 24)
+
+/* Returns the entry of key in the table, or the first entry of its bucket if key is not there */
+unsigned long long* dd_entry(unsigned long long key){
+    unsigned long long* bucket = &dd_table[key & ((1ULL << dd_table_bits) - 2)];
+    if(dd_lock(__atomic_load_n(&bucket[1], __ATOMIC_RELAXED)) == dd_lock(key)){
+        return &bucket[1];
+    }
+    return bucket;
+}
+
+/* Stores data for key, with tricks left, in its bucket: over its own entry, else over the first if it has no more tricks left */
+/* (moving the first to the second), else over the second */
+void dd_store(unsigned long long key, int cards, unsigned long long data){
+    unsigned long long* bucket = &dd_table[key & ((1ULL << dd_table_bits) - 2)];
+    unsigned long long first = __atomic_load_n(&bucket[0], __ATOMIC_RELAXED);
+    data |= (dd_lock(key) << 24) | ((unsigned long long)cards << 20);
+    if(dd_lock(first) == dd_lock(key)){
+        __atomic_store_n(&bucket[0], data, __ATOMIC_RELAXED);
+    }else if(dd_lock(__atomic_load_n(&bucket[1], __ATOMIC_RELAXED)) == dd_lock(key) || (int)((first >> 20) & 15) > cards){
+        __atomic_store_n(&bucket[1], data, __ATOMIC_RELAXED);
+    }else{
+        __atomic_store_n(&bucket[1], first, __ATOMIC_RELAXED);
+        __atomic_store_n(&bucket[0], data, __ATOMIC_RELAXED);
+    }
+}
+
+/* Returns the points contained in the cards of mask */
+int dd_points(unsigned long long mask){
+    int points = 0;
+    for(int v = 5; v < 10; v++){
+        unsigned long long rank = (1ULL << v) | (1ULL << (10+v)) | (1ULL << (20+v)) | (1ULL << (30+v));
+        points += true_value[v] * __builtin_popcountll(mask & rank);
+    }
+    return points;
+}
+
+/* Returns the index in play order of the card taking the k cards of tabled, same rule as collect_table */
+int dd_winner(int* tabled, int k, int bris){
+    int win = 0;
+    for(int i = 1; i < k; i++){
+        if(tabled[i]/10 == tabled[win]/10){
+            if(tabled[i] > tabled[win]) win = i;
+        }else if(tabled[i]/10 == bris){
+            win = i;
+        }
+    }
+    return win;
+}
+
+/* Fills moves with the cards seat may usefully play, best guesses first, skipping zero point cards equivalent to one already listed */
+/* runs receives the run of each move: cards of one suit in the hand with no other live card between them take the same tricks */
+/* Returns the number of moves */
+int dd_moves(dd_search* s, int seat, int k, int* moves, int* runs){
+    unsigned long long hand = s->hand[seat];
+    unsigned long long live = s->table_mask | s->stock_mask;
+    for(int i = 0; i < n_players; i++){
+        live |= s->hand[i];
+    }
+
+    int win = (k > 0) ? dd_winner(s->tabled, k, s->bris) : -1;
+    int partner_winning = (k > 0) && s->team[(seat - k + win + n_players) % n_players] == s->team[seat];
+    int table_points = 0;
+    for(int i = 0; i < k; i++){
+        table_points += true_value[s->tabled[i]%10];
+    }
+
+    int n = 0;
+    int order[n_hand];
+    int run_id = 0;
+    for(int suit = 0; suit < 4; suit++){
+        int zero = 0, run = 0;
+        for(int v = 0; v < 10; v++){
+            int bit = suit*10 + v;
+            if(!(hand & (1ULL << bit))){
+                if(live & (1ULL << bit)) zero = run = 0;
+                continue;
+            }
+            //Zero point cards with only played cards between them win and lose exactly the same tricks
+            if(v < 5 && zero) continue;
+            zero = (v < 5);
+            if(!run) run_id++;
+            run = 1;
+
+            int points = true_value[v];
+            int guess;
+            if(k == 0){
+                guess = -points - (suit == s->bris ? 20 : 0) - v;
+            }else{
+                s->tabled[k] = bit;
+                int beats = dd_winner(s->tabled, k+1, s->bris) == k;
+                if(partner_winning){
+                    guess = beats ? -v : 2*points;
+                }else if(beats){
+                    guess = 50 + table_points - (suit == s->bris ? 10 + v : v);
+                }else{
+                    guess = -points - v;
+                }
+            }
+            moves[n] = bit;
+            order[n] = guess;
+            runs[n] = run_id;
+            for(int i = n; i > 0 && order[i] > order[i-1]; i--){
+                int t = order[i]; order[i] = order[i-1]; order[i-1] = t;
+                t = moves[i]; moves[i] = moves[i-1]; moves[i-1] = t;
+                t = runs[i]; runs[i] = runs[i-1]; runs[i-1] = t;
+            }
+            n++;
+        }
+    }
+    return n;
+}
+
+/* Alpha-beta search of the points the +1 team takes from here (current trick included) under perfect information */
+/* leader started the current trick and k cards are tabled, fail-soft within the window alpha, beta */
+int dd_value(dd_search* s, int leader, int k, int alpha, int beta){
+    s->nodes++;
+
+    if(k == n_players){
+        int win = dd_winner(s->tabled, k, s->bris);
+        int winner = (leader + win) % n_players;
+        int gained = s->team[winner] > 0 ? dd_points(s->table_mask) : 0;
+        int tabled[n_players];
+        memcpy(tabled, s->tabled, sizeof(tabled));
+        unsigned long long table_mask = s->table_mask;
+        s->table_mask = 0;
+        //Every seat draws from the stock, the taker first, as draw_cards does
+#if n_stock > 0
+        int drawn = s->drawn;
+        if(drawn < n_stock){
+            s->key ^= dd_zobrist_drawn[drawn / n_players];
+            for(int i = 0; i < n_players; i++){
+                int c = s->stock[s->drawn++];
+                s->hand[(winner + i) % n_players] |= 1ULL << c;
+                s->stock_mask &= ~(1ULL << c);
+                s->key ^= dd_zobrist[(winner + i) % n_players][c];
+            }
+        }
+#endif
+        int v = gained + dd_value(s, winner, 0, alpha - gained, beta - gained);
+#if n_stock > 0
+        if(drawn < n_stock){
+            s->key ^= dd_zobrist_drawn[drawn / n_players];
+            while(s->drawn > drawn){
+                int c = s->stock[--s->drawn];
+                int holder = (winner + s->drawn - drawn) % n_players;
+                s->hand[holder] &= ~(1ULL << c);
+                s->stock_mask |= 1ULL << c;
+                s->key ^= dd_zobrist[holder][c];
+            }
+        }
+#endif
+        s->table_mask = table_mask;
+        memcpy(s->tabled, tabled, sizeof(tabled));
+        return v;
+    }
+
+    int seat = (leader + k) % n_players;
+    int cards = __builtin_popcountll(s->hand[seat]);
+    int tricks = MIN(15, cards + (n_stock - s->drawn) / n_players);
+    unsigned long long key = 0;
+    int hint = -1;
+    int lower = 0, upper = 0;
+    int alpha_orig = alpha, beta_orig = beta;
+    unsigned long long* entry = NULL;
+    if(k == 0){
+        unsigned long long all = 0;
+        for(int i = 0; i < n_players; i++){
+            all |= s->hand[i];
+        }
+        if(all == 0){
+            return 0;
+        }
+        int total = dd_points(all | s->stock_mask);
+        if(total <= alpha) return total;
+        if(beta <= 0) return 0;
+
+        key = s->key ^ dd_zobrist_leader[leader];
+        entry = dd_entry(key);
+        unsigned long long data = __atomic_load_n(entry, __ATOMIC_RELAXED);
+        upper = total;
+        if(dd_lock(data) == dd_lock(key)){
+            lower = data & 127;
+            upper = (data >> 7) & 127;
+            hint = (int)((data >> 14) & 63) - 1;
+        }
+        if(lower >= beta) return lower;
+        if(upper <= alpha) return upper;
+        alpha = MAX(alpha, lower);
+        beta = MIN(beta, upper);
+        alpha_orig = alpha;
+        beta_orig = beta;
+    }
+
+    int maximizing = s->team[seat] > 0;
+    int moves[n_hand];
+    int runs[n_hand];
+    int values[n_hand];
+    int n = dd_moves(s, seat, k, moves, runs);
+    for(int i = 1; i < n && hint != -1; i++){
+        if(moves[i] == hint){
+            int t = runs[i]; runs[i] = runs[0]; runs[0] = t;
+            moves[i] = moves[0];
+            moves[0] = hint;
+        }
+    }
+
+    //The last card of a trick leads to positions that may already be in the table, one that cuts off saves searching the others
+    //(not while the stock lasts, the draws change the position)
+    if(k == n_players - 1 && cards > 2 && s->drawn == n_stock){
+        for(int i = 0; i < n; i++){
+            s->tabled[k] = moves[i];
+            int winner = (leader + dd_winner(s->tabled, n_players, s->bris)) % n_players;
+            int gained = s->team[winner] > 0 ? dd_points(s->table_mask | (1ULL << moves[i])) : 0;
+            unsigned long long child = s->key ^ dd_zobrist[seat][moves[i]] ^ dd_zobrist_leader[winner];
+            unsigned long long data = __atomic_load_n(dd_entry(child), __ATOMIC_RELAXED);
+            if(dd_lock(data) != dd_lock(child)) continue;
+            if(maximizing && (int)(data & 127) + gained >= beta) return (data & 127) + gained;
+            if(!maximizing && (int)((data >> 7) & 127) + gained <= alpha) return ((data >> 7) & 127) + gained;
+        }
+    }
+
+    int best = maximizing ? -1 : 1000;
+    int best_move = -1;
+    for(int i = 0; i < n; i++){
+        //A card of the run of an earlier move can only change the result by the difference of their points
+        int skip = 0;
+        for(int j = 0; j < i && !skip; j++){
+            int delta = abs(true_value[moves[i]%10] - true_value[moves[j]%10]);
+            if(runs[j] == runs[i] && (maximizing ? values[j] + delta <= alpha : values[j] - delta >= beta)){
+                best = maximizing ? MAX(best, values[j] + delta) : MIN(best, values[j] - delta);
+                skip = 1;
+            }
+        }
+        if(skip){
+            values[i] = maximizing ? 1000 : -1000;
+            continue;
+        }
+
+        unsigned long long bit = 1ULL << moves[i];
+        s->hand[seat] &= ~bit;
+        s->table_mask |= bit;
+        s->tabled[k] = moves[i];
+        s->key ^= dd_zobrist[seat][moves[i]];
+        int v = dd_value(s, leader, k+1, alpha, beta);
+        s->hand[seat] |= bit;
+        s->table_mask &= ~bit;
+        s->key ^= dd_zobrist[seat][moves[i]];
+        values[i] = v;
+        if(maximizing ? v > best : v < best){
+            best = v;
+            best_move = moves[i];
+        }
+        if(maximizing){
+            alpha = MAX(alpha, v);
+        }else{
+            beta = MIN(beta, v);
+        }
+        if(alpha >= beta) break;
+    }
+
+    if(entry != NULL){
+        if(best <= alpha_orig){
+            upper = MIN(upper, best);
+        }else if(best >= beta_orig){
+            lower = MAX(lower, best);
+        }else{
+            lower = upper = best;
+        }
+        dd_store(key, tricks, (unsigned long long)lower | ((unsigned long long)upper << 7) | ((unsigned long long)(best_move + 1) << 14));
+    }
+    return best;
+}
+
+/* Returns the exact value of dd_value by narrowing null window searches that share the transposition table */
+/* The first window tests guess (aspiration, skipped when guess is -1), the rest halve the interval left */
+int dd_solve(dd_search* s, int leader, int k, int guess){
+    int lower = 0, upper = 120;
+    while(lower < upper){
+        int mid = (lower + upper + 1) / 2;
+        if(guess > lower && guess <= upper){
+            mid = guess;
+        }
+        guess = -1;
+        int v = dd_value(s, leader, k, mid - 1, mid);
+        if(v >= mid){
+            lower = v;
+        }else{
+            upper = v;
+        }
+    }
+    return lower;
+}
+
+/* Sets the key of the hands of s from dd_zobrist, filling dd_zobrist and dd_zobrist_drawn with fixed pseudo random keys (splitmix64) */
+void dd_init_key(dd_search* s){
+    unsigned long long x = 0x9E3779B97F4A7C15ULL;
+    for(int i = 0; i < n_players; i++){
+        dd_zobrist_leader[i] = splitmix64(&x);
+        for(int c = 0; c < n_cards; c++){
+            dd_zobrist[i][c] = splitmix64(&x);
+        }
+    }
+    for(int i = 0; i <= n_stock/n_players; i++){
+        dd_zobrist_drawn[i] = splitmix64(&x);
+    }
+    s->key = 0;
+    for(int i = 0; i < n_players; i++){
+        for(int c = 0; c < n_cards; c++){
+            if(s->hand[i] & (1ULL << c)){
+                s->key ^= dd_zobrist[i][c];
+            }
+        }
+    }
+}
+
+typedef struct dd_job{
+    dd_search root;
+    int caller;
+    int leads[n_hand];
+    int values[n_hand];             //Value of each lead, bounded by the replies solved so far until every reply is done
+    int replies[n_hand][n_hand];    //Cards the next seat may usefully answer each lead with, best guesses first
+    int n_replies[n_hand];
+    int pairs[n_hand*n_hand];       //lead*n_hand + reply for every reply after the first of its lead
+    int n_pairs;
+    int guess;
+    long long nodes;
+    int n_leads;
+    pthread_mutex_t lock;
+} dd_job;
+
+/* Sets s to the root of job with lead played, answered by reply of it unless reply is -1 */
+void dd_play_pair(dd_job* job, int lead, int reply, dd_search* s){
+    *s = job->root;
+    s->nodes = 0;
+    int c = job->leads[lead];
+    s->hand[job->caller] &= ~(1ULL << c);
+    s->key ^= dd_zobrist[job->caller][c];
+    s->tabled[0] = c;
+    s->table_mask = 1ULL << c;
+    if(reply != -1){
+        int second = (job->caller + 1) % n_players;
+        c = job->replies[lead][reply];
+        s->hand[second] &= ~(1ULL << c);
+        s->key ^= dd_zobrist[second][c];
+        s->tabled[1] = c;
+        s->table_mask |= 1ULL << c;
+    }
+}
+
+/* Item of run_dd, solves the first reply to lead exactly, aspiring to the value of the last one solved, which bounds the lead */
+void dd_first_reply(void* arg, int lead){
+    dd_job* job = arg;
+    pthread_mutex_lock(&job->lock);
+    int guess = job->guess;
+    pthread_mutex_unlock(&job->lock);
+
+    dd_search s;
+    dd_play_pair(job, lead, 0, &s);
+    int v = dd_solve(&s, job->caller, 2, guess);
+
+    pthread_mutex_lock(&job->lock);
+    job->nodes += s.nodes;
+    job->values[lead] = v;
+    job->guess = v;
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* Item of run_dd, tests another reply against the bound its lead has so far with a null window and solves it exactly only if it */
+/* does better for the replying seat, so the lead ends with the value of its best reply */
+void dd_other_reply(void* arg, int pair){
+    dd_job* job = arg;
+    int lead = job->pairs[pair] / n_hand;
+    int maximizing = job->root.team[(job->caller + 1) % n_players] > 0;
+    pthread_mutex_lock(&job->lock);
+    int bound = job->values[lead];
+    pthread_mutex_unlock(&job->lock);
+
+    dd_search s;
+    dd_play_pair(job, lead, job->pairs[pair] % n_hand, &s);
+    int v = maximizing ? dd_value(&s, job->caller, 2, bound, bound + 1) : dd_value(&s, job->caller, 2, bound - 1, bound);
+    if(maximizing ? v > bound : v < bound){
+        v = dd_solve(&s, job->caller, 2, v);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->nodes += s.nodes;
+    job->values[lead] = maximizing ? MAX(job->values[lead], v) : MIN(job->values[lead], v);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* When the user uses -d flag, solves the deal in str ("<40 cards> <call> <caller>") exactly for every opening lead of the caller */
+/* With a stock the call must be the card turned up, the last of the deal, and the caller is the seat leading */
+/* Prints the points the caller's team takes with perfect play by every seat, returns the best of them */
+/* Cores shorten a solve by at most the share of its largest items, a full 5 player deal is not solved in seconds (one core had not finished one in 30 minutes) */
+int run_dd(char* str){
+    card card_arr[n_cards];
+    char buf[512];
+    strncpy(buf, str, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    //The call and caller are the last two fields, everything before them is the deal
+    char* caller_str = strrchr(buf, ' ');
+    char* call_str = NULL;
+    if(caller_str != NULL){
+        *caller_str++ = '\0';
+        call_str = strrchr(buf, ' ');
+    }
+    if(call_str == NULL){
+        fprintf(stderr, "Error: Expected \"<deal> <call> <caller>\" for -d\n");
+        exit(EXIT_FAILURE);
+    }
+    *call_str++ = '\0';
+    const char* cursor = buf;
+    if(parse_deal(&cursor, buf + strlen(buf), card_arr) != 1){
+        fprintf(stderr, "Error: Invalid deal \"%s\"\n", buf);
+        exit(EXIT_FAILURE);
+    }
+    card final_call;
+    int caller = atoi(caller_str);
+    if(strlen(call_str) != 2 || caller < 0 || caller >= n_players){
+        fprintf(stderr, "Error: Invalid call %s by player %s\n", call_str, caller_str);
+        exit(EXIT_FAILURE);
+    }
+    make_card(&final_call, atoi(call_str));
+    if(n_stock > 0 && (final_call.value != card_arr[n_cards-1].value || final_call.suit != card_arr[n_cards-1].suit)){
+        fprintf(stderr, "Error: Briscola is the card turned up, %d%d, not %s\n", card_arr[n_cards-1].value, card_arr[n_cards-1].suit, call_str);
+        exit(EXIT_FAILURE);
+    }
+
+    dd_job job;
+    memset(&job, 0, sizeof(job));
+    job.caller = caller;
+    job.root.bris = final_call.suit;
+    for(int i = 0; i < n_players; i++){
+        job.root.team[i] = (i == caller) ? 1 : -1;
+#if n_players != 5
+        job.root.team[i] = seat_team((i - caller + n_players) % n_players);
+#endif
+        for(int j = 0; j < n_hand; j++){
+            card c = card_arr[i*n_hand + j];
+            job.root.hand[i] |= 1ULL << (c.suit*10 + c.value);
+            if(n_players == 5 && c.value == final_call.value && c.suit == final_call.suit){
+                job.root.team[i] = 1;
+            }
+        }
+    }
+    for(int i = 0; i < n_stock; i++){
+        card c = card_arr[n_players*n_hand + i];
+        job.root.stock[i] = c.suit*10 + c.value;
+        job.root.stock_mask |= 1ULL << job.root.stock[i];
+    }
+
+    //Work is split below the root so cores have it: the first reply to every lead is solved, then every other reply on its own,
+    //best guesses first, zero point cards equivalent to a listed one are not
+    int runs[n_hand];
+    job.n_leads = dd_moves(&job.root, caller, 0, job.leads, runs);
+    dd_init_key(&job.root);
+    job.guess = -1;
+    for(int i = 0; i < job.n_leads; i++){
+        dd_search s;
+        dd_play_pair(&job, i, -1, &s);
+        job.n_replies[i] = dd_moves(&s, (caller + 1) % n_players, 1, job.replies[i], runs);
+        for(int j = 1; j < job.n_replies[i]; j++){
+            job.pairs[job.n_pairs++] = i*n_hand + j;
+        }
+    }
+
+    dd_table = calloc(1ULL << dd_table_bits, sizeof(unsigned long long));
+    if(dd_table == NULL){
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&job.lock, NULL);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_parallel(dd_first_reply, &job, job.n_leads);
+    run_parallel(dd_other_reply, &job, job.n_pairs);
+    double seconds = elapsed(start);
+
+#if n_players != 5
+    printf("Double dummy: Player %d leads, briscola %d of %d turned up, team ", caller, final_call.value, final_call.suit);
+#else
+    printf("Double dummy: Player %d calls %d of %d, team ", caller, final_call.value, final_call.suit);
+#endif
+    for(int i = 0; i < n_players; i++){
+        printf("%c", job.root.team[i] > 0 ? '+' : '-');
+    }
+    printf("\n");
+
+    int best = -1;
+    for(int bit = 0; bit < n_cards; bit++){
+        if(!(job.root.hand[caller] & (1ULL << bit))){
+            continue;
+        }
+        //A lead that was not solved takes the value of the zero point card below it it is equivalent to
+        int i = -1;
+        for(int same = bit; i == -1; same--){
+            for(int j = 0; j < job.n_leads; j++){
+                if(job.leads[j] == same) i = j;
+            }
+        }
+        card lead = dd_card(bit);
+        printf("Lead %d%d: caller team takes %d\n", lead.value, lead.suit, job.values[i]);
+        best = MAX(best, job.values[i]);
+    }
+    printf("Best lead gives %d points (%lld nodes, %.3fs)\n", best, job.nodes, seconds);
+
+    pthread_mutex_destroy(&job.lock);
+    free(dd_table);
+    dd_table = NULL;
+    return best;
+}
+
+#define rollout_lanes 256
+#define rollout_width 8
+
+/* Many independent games stored lane by lane (struct of arrays): a kernel plays rollout_width games at once and a batch holds */
+/* many times that. Cards are numbered suit*10 + value, a seat holds its cards in its first held slots and may play any of them */
+typedef struct rollout_batch{
+    int hand[n_players][n_hand][rollout_lanes];     //Cards held by each seat, slots from held on are unused
+    int held[n_players][rollout_lanes];
+    int starting[rollout_lanes];
+    int bris[rollout_lanes];
+    int team[n_players][rollout_lanes];
+    int points[n_players][rollout_lanes];
+    int played[n_cards/n_players][n_players][rollout_lanes];    //Card each seat played to each trick
+    int stock[n_stock + 1][rollout_lanes];          //Stock in draw order, the last card turned up (the spare row keeps it valid without one)
+    int deck[n_cards][rollout_lanes];               //Deck being shuffled by the deal
+    unsigned int rng[rollout_lanes];
+} rollout_batch;
+
+//Maps a random number to 0..n-1 with its high 16 bits, every kernel does the same so they play the same games
+#define rollout_below(x, n) ((int)((((x) >> 16) * (unsigned int)(n)) >> 16))
+
+/* Returns the next number of the xorshift32 generator of lane l */
+unsigned int rollout_random(rollout_batch* b, int l){
+    unsigned int x = b->rng[l];
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return b->rng[l] = x;
+}
+
+/* Returns 1 if seat holds card c in lane l */
+int rollout_holds(rollout_batch* b, int seat, int c, int l){
+    for(int j = 0; j < b->held[seat][l]; j++){
+        if(b->hand[seat][j][l] == c) return 1;
+    }
+    return 0;
+}
+
+/* Deals a random game into lane l, seat 0 leads and in Chiamata calls the highest briscola it does not hold, with a stock */
+/* the last card of it names briscola */
+void rollout_deal_scalar(rollout_batch* b, int l){
+    for(int i = 0; i < n_cards; i++){
+        b->deck[i][l] = i;
+    }
+    for(int i = n_cards - 1; i > 0; i--){
+        int j = rollout_below(rollout_random(b, l), i + 1);
+        int t = b->deck[i][l]; b->deck[i][l] = b->deck[j][l]; b->deck[j][l] = t;
+    }
+    for(int i = 0; i < n_players; i++){
+        b->held[i][l] = n_hand;
+        b->points[i][l] = 0;
+        for(int j = 0; j < n_hand; j++){
+            b->hand[i][j][l] = b->deck[i*n_hand + j][l];
+        }
+    }
+#if n_players != 5
+    for(int i = 0; i < n_stock; i++){
+        b->stock[i][l] = b->deck[n_players*n_hand + i][l];
+    }
+    int bris = b->deck[n_cards-1][l] / 10;
+    for(int i = 0; i < n_players; i++){
+        b->team[i][l] = seat_team(i);
+    }
+#else
+    int bris = rollout_below(rollout_random(b, l), 4);
+    int call = bris*10 + 9;
+    while(rollout_holds(b, 0, call, l)){
+        call--;
+    }
+    for(int i = 0; i < n_players; i++){
+        b->team[i][l] = (i == 0 || rollout_holds(b, i, call, l)) ? 1 : -1;
+    }
+#endif
+    b->bris[l] = bris;
+    b->starting[l] = 0;
+}
+
+/* Plays lane l of b to the end of the game with random cards: every seat plays a random card it holds, the highest briscola, */
+/* else the highest card of the lead suit, takes the points and leads next, then every seat draws, the taker first */
+/* score receives the points of the caller's team minus the others' */
+void rollout_play_scalar(rollout_batch* b, int l, int* score){
+    for(int trick = 0; trick < n_cards/n_players; trick++){
+        //Each seat plays the card in a random slot and moves its last card into that slot
+        for(int s = 0; s < n_players; s++){
+            int held = b->held[s][l]--;
+            int r = rollout_below(rollout_random(b, l), held);
+            b->played[trick][s][l] = b->hand[s][r][l];
+            b->hand[s][r][l] = b->hand[s][held - 1][l];
+        }
+        int lead = b->played[trick][b->starting[l]][l] / 10;
+        int winner = 0;
+        int best_rank = -1;
+        int points = 0;
+        for(int s = 0; s < n_players; s++){
+            int suit = b->played[trick][s][l] / 10;
+            int value = b->played[trick][s][l] % 10;
+            int rank = (suit == b->bris[l]) ? 20 + value : (suit == lead) ? 10 + value : 0;
+            if(rank > best_rank){
+                best_rank = rank;
+                winner = s;
+            }
+            points += true_value[value];
+        }
+        b->points[winner][l] += points;
+        b->starting[l] = winner;
+#if n_stock > 0
+        if((trick + 1)*n_players <= n_stock){
+            for(int s = 0; s < n_players; s++){
+                b->hand[s][b->held[s][l]++][l] = b->stock[trick*n_players + (s - winner + n_players) % n_players][l];
+            }
+        }
+#endif
+    }
+    score[l] = 0;
+    for(int i = 0; i < n_players; i++){
+        score[l] += b->team[i][l] * b->points[i][l];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define rollout_simd 1
+
+/* Next numbers of eight xorshift32 generators */
+__attribute__((target("avx2")))
+__m256i rollout_random_avx2(__m256i x){
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+    return _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+}
+
+/* rollout_below of eight lanes */
+__attribute__((target("avx2")))
+__m256i rollout_below_avx2(__m256i x, __m256i n){
+    return _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(x, 16), n), 16);
+}
+
+/* Suit of eight cards, c*205 >> 11 equals c/10 for every card */
+__attribute__((target("avx2")))
+__m256i rollout_suit_avx2(__m256i c){
+    return _mm256_srli_epi32(_mm256_mullo_epi32(c, _mm256_set1_epi32(205)), 11);
+}
+
+/* AVX2 version of rollout_deal_scalar for the rollout_width lanes from l */
+__attribute__((target("avx2")))
+void rollout_deal_avx2(rollout_batch* b, int l){
+    __m256i x = _mm256_loadu_si256((__m256i*)&b->rng[l]);
+    __m256i lane = _mm256_add_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(l));
+    for(int i = 0; i < n_cards; i++){
+        _mm256_storeu_si256((__m256i*)&b->deck[i][l], _mm256_set1_epi32(i));
+    }
+    for(int i = n_cards - 1; i > 0; i--){
+        x = rollout_random_avx2(x);
+        __m256i j = rollout_below_avx2(x, _mm256_set1_epi32(i + 1));
+        __m256i drawn = _mm256_i32gather_epi32(&b->deck[0][0], _mm256_add_epi32(_mm256_mullo_epi32(j, _mm256_set1_epi32(rollout_lanes)), lane), 4);
+        __m256i top = _mm256_loadu_si256((__m256i*)&b->deck[i][l]);
+        _mm256_storeu_si256((__m256i*)&b->deck[i][l], drawn);
+        //AVX2 has no scatter, the card swapped down is stored lane by lane
+        int moved[rollout_width], at[rollout_width];
+        _mm256_storeu_si256((__m256i*)moved, top);
+        _mm256_storeu_si256((__m256i*)at, j);
+        for(int k = 0; k < rollout_width; k++){
+            b->deck[at[k]][l + k] = moved[k];
+        }
+    }
+    for(int i = 0; i < n_players; i++){
+        _mm256_storeu_si256((__m256i*)&b->held[i][l], _mm256_set1_epi32(n_hand));
+        _mm256_storeu_si256((__m256i*)&b->points[i][l], _mm256_setzero_si256());
+        for(int j = 0; j < n_hand; j++){
+            _mm256_storeu_si256((__m256i*)&b->hand[i][j][l], _mm256_loadu_si256((__m256i*)&b->deck[i*n_hand + j][l]));
+        }
+    }
+#if n_players != 5
+    for(int i = 0; i < n_stock; i++){
+        _mm256_storeu_si256((__m256i*)&b->stock[i][l], _mm256_loadu_si256((__m256i*)&b->deck[n_players*n_hand + i][l]));
     }
-    printf("Final Caller: Player %d calls %d of %d\n\n", caller, final_call.value, final_call.suit);
-
-    players[caller].team = 1;
+    __m256i bris = rollout_suit_avx2(_mm256_loadu_si256((__m256i*)&b->deck[n_cards-1][l]));
     for(int i = 0; i < n_players; i++){
-        if(contains(players[i].hand, n_hand, final_call) >= 0){
-            players[i].team = 1;
-            break;
+        _mm256_storeu_si256((__m256i*)&b->team[i][l], _mm256_set1_epi32(seat_team(i)));
+    }
+#else
+    x = rollout_random_avx2(x);
+    __m256i bris = rollout_below_avx2(x, _mm256_set1_epi32(4));
+    //The call is the highest briscola seat 0 does not hold, seat 0 holds too few cards to have them all
+    __m256i call = _mm256_setzero_si256();
+    __m256i found = _mm256_setzero_si256();
+    for(int v = 9; v >= 0; v--){
+        __m256i candidate = _mm256_add_epi32(_mm256_mullo_epi32(bris, _mm256_set1_epi32(10)), _mm256_set1_epi32(v));
+        __m256i missing = _mm256_cmpeq_epi32(found, found);
+        for(int j = 0; j < n_hand; j++){
+            missing = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i*)&b->hand[0][j][l]), candidate), missing);
         }
+        missing = _mm256_andnot_si256(found, missing);
+        call = _mm256_blendv_epi8(call, candidate, missing);
+        found = _mm256_or_si256(found, missing);
     }
-
     for(int i = 0; i < n_players; i++){
-        printf("Player %d team is %d\n", i, players[i].team);
+        __m256i partner = _mm256_set1_epi32(i == 0 ? -1 : 0);
+        for(int j = 0; j < n_hand; j++){
+            partner = _mm256_or_si256(partner, _mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i*)&b->hand[i][j][l]), call));
+        }
+        //-1 for the caller's team and 0 for the others becomes 1 and -1
+        _mm256_storeu_si256((__m256i*)&b->team[i][l], _mm256_sub_epi32(_mm256_set1_epi32(-1), _mm256_add_epi32(partner, partner)));
     }
-    printf("\n");
+#endif
+    _mm256_storeu_si256((__m256i*)&b->bris[l], bris);
+    _mm256_storeu_si256((__m256i*)&b->starting[l], _mm256_setzero_si256());
+    _mm256_storeu_si256((__m256i*)&b->rng[l], x);
+}
 
-    game_state game;
-    setup_state(&game, card_arr, players, caller, final_call);
+/* AVX2 version of rollout_play_scalar for the rollout_width lanes from l, a random slot is chosen and emptied with compares and */
+/* blends over the slots of the seat, so every step of the game is a vector operation */
+__attribute__((target("avx2")))
+void rollout_play_avx2(rollout_batch* b, int l, int* score){
+    __m256i x = _mm256_loadu_si256((__m256i*)&b->rng[l]);
+    __m256i starting = _mm256_loadu_si256((__m256i*)&b->starting[l]);
+    __m256i bris = _mm256_loadu_si256((__m256i*)&b->bris[l]);
+    __m256i points[n_players];
+    for(int s = 0; s < n_players; s++){
+        points[s] = _mm256_loadu_si256((__m256i*)&b->points[s][l]);
+    }
+    for(int trick = 0; trick < n_cards/n_players; trick++){
+        __m256i played[n_players];
+        __m256i lead = _mm256_setzero_si256();
+        for(int s = 0; s < n_players; s++){
+            __m256i held = _mm256_loadu_si256((__m256i*)&b->held[s][l]);
+            x = rollout_random_avx2(x);
+            __m256i r = rollout_below_avx2(x, held);
+            __m256i last = _mm256_sub_epi32(held, _mm256_set1_epi32(1));
+            __m256i slots[n_hand];
+            __m256i c = _mm256_setzero_si256();
+            __m256i moved = _mm256_setzero_si256();
+            for(int j = 0; j < n_hand; j++){
+                slots[j] = _mm256_loadu_si256((__m256i*)&b->hand[s][j][l]);
+                c = _mm256_blendv_epi8(c, slots[j], _mm256_cmpeq_epi32(r, _mm256_set1_epi32(j)));
+                moved = _mm256_blendv_epi8(moved, slots[j], _mm256_cmpeq_epi32(last, _mm256_set1_epi32(j)));
+            }
+            for(int j = 0; j < n_hand; j++){
+                _mm256_storeu_si256((__m256i*)&b->hand[s][j][l], _mm256_blendv_epi8(slots[j], moved, _mm256_cmpeq_epi32(r, _mm256_set1_epi32(j))));
+            }
+            _mm256_storeu_si256((__m256i*)&b->held[s][l], last);
+            _mm256_storeu_si256((__m256i*)&b->played[trick][s][l], c);
+            played[s] = c;
+            lead = _mm256_blendv_epi8(lead, c, _mm256_cmpeq_epi32(starting, _mm256_set1_epi32(s)));
+        }
 
-    int count = 0;
-    int play;
-    int play_index;
-    while(game.num_cards_played < 40){
-        if(count%n_players == 0 && game.num_cards_played > 0){
-            game.starting = (collect_table(&game) + game.starting) % n_players;
-            next_state(&game, players, game.starting);
-            print_state(game);
-            printf("Current Evaluation: %d\n", evaluation(game));
+        lead = rollout_suit_avx2(lead);
+        __m256i best = _mm256_set1_epi32(-1);
+        __m256i winner = _mm256_setzero_si256();
+        __m256i taken = _mm256_setzero_si256();
+        for(int s = 0; s < n_players; s++){
+            __m256i suit = rollout_suit_avx2(played[s]);
+            __m256i value = _mm256_sub_epi32(played[s], _mm256_mullo_epi32(suit, _mm256_set1_epi32(10)));
+            __m256i rank = _mm256_and_si256(_mm256_cmpeq_epi32(suit, lead), _mm256_add_epi32(value, _mm256_set1_epi32(10)));
+            rank = _mm256_blendv_epi8(rank, _mm256_add_epi32(value, _mm256_set1_epi32(20)), _mm256_cmpeq_epi32(suit, bris));
+            __m256i higher = _mm256_cmpgt_epi32(rank, best);
+            best = _mm256_max_epi32(best, rank);
+            winner = _mm256_blendv_epi8(winner, _mm256_set1_epi32(s), higher);
+            taken = _mm256_add_epi32(taken, _mm256_i32gather_epi32(true_value, value, 4));
+        }
+        for(int s = 0; s < n_players; s++){
+            points[s] = _mm256_add_epi32(points[s], _mm256_and_si256(_mm256_cmpeq_epi32(winner, _mm256_set1_epi32(s)), taken));
         }
+        starting = winner;
 
-        if(game.p.bot){
-            play = make_decision(game);
-        }else{
-            print_hand(game.p);
-            printf("Player %d? ", game.p.position);
-            scanf("%d", &play);
-            card c;
-            make_card(&c, play);
-            if((play_index = contains(game.p.hand, n_hand, c)) == -1){
-                printf("Error: Please play card from hand.");
-                continue;
+#if n_stock > 0
+        if((trick + 1)*n_players <= n_stock){
+            __m256i lane = _mm256_add_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(l));
+            for(int s = 0; s < n_players; s++){
+                __m256i order = _mm256_sub_epi32(_mm256_set1_epi32(s), winner);
+                order = _mm256_add_epi32(order, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), order), _mm256_set1_epi32(n_players)));
+                __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(order, _mm256_set1_epi32(trick*n_players)), _mm256_set1_epi32(rollout_lanes)), lane);
+                __m256i drawn = _mm256_i32gather_epi32(&b->stock[0][0], index, 4);
+                __m256i held = _mm256_loadu_si256((__m256i*)&b->held[s][l]);
+                for(int j = 0; j < n_hand; j++){
+                    __m256i slot = _mm256_loadu_si256((__m256i*)&b->hand[s][j][l]);
+                    _mm256_storeu_si256((__m256i*)&b->hand[s][j][l], _mm256_blendv_epi8(slot, drawn, _mm256_cmpeq_epi32(held, _mm256_set1_epi32(j))));
+                }
+                _mm256_storeu_si256((__m256i*)&b->held[s][l], _mm256_add_epi32(held, _mm256_set1_epi32(1)));
             }
-            play = play_index;
         }
-        
-        printf("Player %d plays %d%d\n", game.p.position, game.p.hand[play].value, game.p.hand[play].suit);
-        play_card(&game, game.p.hand[play]);
-        set_null(&game.p.hand[play]);
-        set_null(&game.cards_remaining[play+(game.p.position*n_hand)]);
-        next_state(&game, players, (game.p.position+1) % n_players);
-        count++;
+#endif
     }
 
-    collect_table(&game);
-    print_state(game);
-    printf("Current Evaluation: %d\n", evaluation(game));
+    __m256i total = _mm256_setzero_si256();
+    for(int s = 0; s < n_players; s++){
+        _mm256_storeu_si256((__m256i*)&b->points[s][l], points[s]);
+        total = _mm256_add_epi32(total, _mm256_mullo_epi32(_mm256_loadu_si256((__m256i*)&b->team[s][l]), points[s]));
+    }
+    _mm256_storeu_si256((__m256i*)&score[l], total);
+    _mm256_storeu_si256((__m256i*)&b->starting[l], starting);
+    _mm256_storeu_si256((__m256i*)&b->rng[l], x);
+}
+#endif
 
-    return evaluation(game);
+/* Returns 1 if the AVX2 kernels can run on this machine */
+int rollout_has_simd(void){
+#ifdef rollout_simd
+    return __builtin_cpu_supports("avx2");
+#else
+    return 0;
+#endif
 }
 
-/* When the user uses -m flag, allow the user to set the hands of each player (manual deal) */
-int set_card_arr(card* card_arr){
+/* Deals a random game into every lane of b, rollout_width lanes per call of the AVX2 kernel when simd is set */
+void rollout_deal(rollout_batch* b, int simd){
+#ifdef rollout_simd
+    if(simd){
+        for(int l = 0; l < rollout_lanes; l += rollout_width){
+            rollout_deal_avx2(b, l);
+        }
+        return;
+    }
+#endif
+    for(int l = 0; l < rollout_lanes; l++){
+        rollout_deal_scalar(b, l);
+    }
+}
 
-    printf("Please assign 8 cards to each player (00 represents 2 of spades)\n"
-            "Ex. \"03 44 42 81 91 72 01 00\" is a valid hand\n"
-            "Please input all eight cards per line.\n");
+/* Plays every lane of b to the end of the game with random cards, score receives the result of each lane */
+void rollout_play(rollout_batch* b, int* score, int simd){
+#ifdef rollout_simd
+    if(simd){
+        for(int l = 0; l < rollout_lanes; l += rollout_width){
+            rollout_play_avx2(b, l, score);
+        }
+        return;
+    }
+#endif
+    for(int l = 0; l < rollout_lanes; l++){
+        rollout_play_scalar(b, l, score);
+    }
+}
 
-    card buffer[n_cards];
-    init_set_null(buffer, n_cards);
+/* Replays lane l of a finished batch through play_card and collect_table from its dealt state start, drawing as draw_cards does */
+/* Returns 1 if the reference agrees with the batch on every player's points and the final leader */
+int rollout_reference(rollout_batch* start, rollout_batch* b, int l){
+    game_state game;
+    memset(&game, 0, sizeof(game));
+    for(int i = 0; i < n_players; i++){
+        init_set_null(game.cards_taken[i], n_cards);
+    }
+    init_set_null(game.cards_tabled, n_players);
+    game.starting = start->starting[l];
+    game.bris = start->bris[l];
+    game.stock = n_stock;
+    unsigned long long hand[n_players];
+    for(int i = 0; i < n_players; i++){
+        hand[i] = 0;
+        for(int j = 0; j < start->held[i][l]; j++){
+            hand[i] |= 1ULL << start->hand[i][j][l];
+        }
+    }
+    for(int num = 0; num < n_cards; num++){
+        int seat = (game.starting + game.turn) % n_players;
+        int bit = b->played[num / n_players][seat][l];
+        card c = {bit % 10, bit / 10};
+        if(!(hand[seat] & (1ULL << bit))){
+            return 0;
+        }
+        hand[seat] &= ~(1ULL << bit);
+        play_card(&game, c);
+        if(game.num_cards_played % n_players == 0){
+            game.starting = (collect_table(&game) + game.starting) % n_players;
+            game.turn = 0;
+#if n_stock > 0
+            for(int i = 0; i < n_players && game.stock > 0; i++){
+                hand[(game.starting + i) % n_players] |= 1ULL << start->stock[n_stock - game.stock][l];
+                game.stock--;
+            }
+#endif
+        }
+    }
+    for(int i = 0; i < n_players; i++){
+        int points = 0;
+        for(int j = 0; j < n_cards && game.cards_taken[i][j].value != -1; j++){
+            points += true_value[game.cards_taken[i][j].value];
+        }
+        if(points != b->points[i][l]){
+            return 0;
+        }
+    }
+    return game.starting == b->starting[l];
+}
 
-    int cards = 0;
-    int player = 0;
-    char* delim = " ";
-    char* scan_buffer = NULL;
-    int hand_arr[n_hand];
-    size_t size = 0;
-    size_t len = 0;
-    
-    loop:
-    while(cards < n_cards){
+/* Plays count random games on one kernel, checking each against the reference when check is set */
+/* Returns the number of games that disagree with the reference */
+int rollout_report(const char* name, int count, int simd, int check){
+    rollout_batch* b = malloc(sizeof(rollout_batch));
+    rollout_batch* start = malloc(sizeof(rollout_batch));
+    if(b == NULL || start == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int score[rollout_lanes];
+    int mismatches = 0;
+    long long total = 0;
+    for(int l = 0; l < rollout_lanes; l++){
+        b->rng[l] = 0x9E3779B9U * (l + 1);
+    }
 
-        printf("Assign cards to player %d:\n", player);
-        if( (len = getline(&scan_buffer, &size, stdin)) != -1){
-            int n = 0;
-            char* buf = strtok(scan_buffer, delim);
-            while(buf != NULL && n < n_hand){
-                hand_arr[n] = atoi(buf);
-                buf = strtok(NULL, delim);
-                n++;
-            }
-            for(int i = 0; i < n_hand; i++){
-                card c;
-                make_card(&c, hand_arr[i]);
-                if(contains(card_arr, n_cards, c) == -1 || contains(buffer, n_cards, c) >= 0){
-                    printf("Error: Invalid Card Entry %d%d\n", c.value, c.suit);
-                    goto loop;
-                }
-            }
-            for(int i = 0; i < n_hand; i++){
-                card c;
-                c.value = hand_arr[i]/10;
-                c.suit = hand_arr[i]%10;
-                cp_card(c, &buffer[i+cards]);
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int games = 0;
+    while(games < count){
+        rollout_deal(b, simd);
+        if(check){
+            *start = *b;
+        }
+        rollout_play(b, score, simd);
+        for(int l = 0; l < rollout_lanes; l++){
+            total += score[l];
+            if(check && !rollout_reference(start, b, l)){
+                mismatches++;
             }
-        }else{
-            perror("getline");
-            exit(EXIT_FAILURE);
         }
+        games += rollout_lanes;
+    }
+    double seconds = elapsed(t0);
+    printf("  %-6s %10d games %12.0f games/sec  average %+.2f", name, games, seconds > 0 ? games / seconds : 0, (double)total / games);
+    if(check){
+        printf(mismatches == 0 ? "  ok" : "  %d MISMATCHED", mismatches);
+    }
+    printf("\n");
+    free(b);
+    free(start);
+    return mismatches;
+}
 
-        cards+=8;
-        player++;
+/* When the user uses -k flag, checks the rollout kernels against play_card / collect_table then times count random games on each */
+/* Returns the number of mismatched games */
+int run_rollouts(int count){
+    int simd = rollout_has_simd();
+    int mismatches = 0;
+    printf("Rollout check against play_card / collect_table\n");
+    mismatches += rollout_report("scalar", MIN(count, 10000), 0, 1);
+    if(simd){
+        mismatches += rollout_report("avx2", MIN(count, 10000), 1, 1);
     }
-    cp_set(buffer, card_arr, n_cards);
-    free(scan_buffer);
+    printf("Rollout speed\n");
+    rollout_report("scalar", count, 0, 0);
+    if(simd){
+        rollout_report("avx2", count, 1, 0);
+    }else{
+        printf("  avx2 not available, scalar kernels only\n");
+    }
+    printf("%s\n", mismatches == 0 ? "Rollouts: all games match" : "Rollouts: MISMATCHED games");
+    return mismatches;
+}
+
+/* Writes the name of the build for players given the name of this one: the 5 player build is the bare program name, */
+/* the others carry _<players>, so a suffix naming this build's size is dropped before the other size is appended */
+void variant_name(char* out, size_t size, const char* name, int players){
+    size_t length = strlen(name);
+    char own[8];
+    snprintf(own, sizeof(own), "_%d", n_players);
+    if(n_players != 5 && length >= strlen(own) && strcmp(name + length - strlen(own), own) == 0){
+        length -= strlen(own);
+    }
+    if(players == 5){
+        snprintf(out, size, "%.*s", (int)length, name);
+    }else{
+        snprintf(out, size, "%.*s_%d", (int)length, name, players);
+    }
+}
+
+/* When the user uses -v flag for another table size, replaces this process with the build of that size next to the */
+/* running executable, else the build of that size looked up in PATH */
+void run_variant(int players, char** argv){
+    if(players != 2 && players != 4 && players != 5){
+        fprintf(stderr, "Error: Briscola is played by 2, 4 or 5 players, not %d.\n", players);
+        exit(EXIT_FAILURE);
+    }
+    char self[4096];
+    char path[sizeof(self) + 16];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if(length > 0){
+        self[length] = '\0';
+        variant_name(path, sizeof(path), self, players);
+        execv(path, argv);
+    }
+    char* name = strrchr(argv[0], '/');
+    variant_name(path, sizeof(path), name != NULL ? name + 1 : argv[0], players);
+    execvp(path, argv);
+    perror(path);
+    char define[32] = "";
+    if(players != 5){
+        snprintf(define, sizeof(define), " -Dn_players=%d", players);
+    }
+    fprintf(stderr, "Build it next to this program with: cc -O2%s -o %s main.c -lm -lpthread\n", define, path);
+    exit(EXIT_FAILURE);
 }
 
 /* Display usage of program to user */
 void help_msg(char* program){
-    printf("Usage: %s [-s integer] [-p position type] [-m] [-h]\n\n"
+    printf("Usage: %s [-s integer] [-p position type] [-m] [-f file] [-o file] [-a position] [-n depth] [-d deal] [-r width] [-x depth] [-k count] [-g count] [-l file] [-v players] [-c width] [-w file] [-y file] [-t file] [-e file] [-b file] [-h]\n\n"
     "  -s number of simulations\tDefault to \"1\";\n"
-    "  -p position \t\tDefault to \"0\" (position 0-4);\n"
+    "  -p position \t\tDefault to \"0\" (position 0-%d);\n"
     "  -m manual deal\t\tDefault to automatic deal;\n"
-    "  -h\t\t\t\tDisplay this help info.\n", program);
+    "  -f deal file\t\t\tSimulate every deal in file (one deal of 40 cards per line);\n"
+    "  -o output file\t\tDefault to stdout;\n"
+    "  -a position string\t\tAnalyze a single position (format printed as \"Position:\" in game output);\n"
+    "  -n perft depth\t\tCount move generator leaf nodes on the perft positions (or the -a position);\n"
+    "  -d \"deal call caller\"\t\tSolve a fully known deal for every opening lead (double dummy, with a stock the call is the card turned up);\n"
+    "  -r selective width\t\tFully search only this many likeliest opponent replies, reduce the rest (default 0, all);\n"
+    "  -x search depth\t\tDefault to %d opponent plays;\n"
+    "  -k rollout count\t\tCheck the batched rollout kernels against the game rules and time count random games;\n"
+    "  -g lead table count\t\tSearch the opening lead of count random deals and write the lead table to the -o file;\n"
+    "  -l lead table file\t\tPlay opening leads found in the lead table without searching;\n"
+    "  -v players\t\t\tPlay the 2, 4 or 5 player format, default to %d (2 and 4 run program_<players>, 5 runs program, built with -Dn_players);\n"
+    "  -c confidence width\t\tStop -s early once the 95%% confidence interval of the mean is this wide;\n"
+    "  -w checkpoint file\t\tSave -s progress to file every %d seconds, resume from it when it exists;\n"
+    "  -y record file\t\tAppend every position of the games of -s or -f with the final evaluation;\n"
+    "  -t record file\t\tFit the evaluation weights (not the calling weights) to the records and write the parameters to the -o file;\n"
+    "  -e parameter file\t\tLoad evaluation and calling parameters written by -t;\n"
+    "  -b parameter file\t\tPlay -s deals twice, each team once with these parameters and the other with -e (or the defaults), and print the points they gain;\n"
+    "  -h\t\t\t\tDisplay this help info.\n", program, n_players - 1, minimax_depth, n_players, checkpoint_seconds);
     printf("\nNOTE: Program defaults to simulate a single game of bots.\n");
 }
 
@@ -880,11 +3802,30 @@ int main(int argc, char** argv){
     int pvb = 0;
     int bot_pos = 0;
     int manual_deal = 0;
+    char* deal_file = NULL;
+    char* output_file = NULL;
+    char* analysis = NULL;
+    int perft_depth = 0;
+    char* dd_deal = NULL;
+    int rollout_count = 0;
+    int lead_count_gen = 0;
+    char* lead_file = NULL;
+    int variant = n_players;
+    double ci_width = 0;
+    char* checkpoint_file = NULL;
+    char* record_path = NULL;
+    char* tune_file = NULL;
+    char* params_file = NULL;
+    char* duel_file = NULL;
+
+    //getopt reorders argv, -v passes the command line on as it was given
+    char* given_argv[argc + 1];
+    memcpy(given_argv, argv, sizeof(char*) * (argc + 1));
 
     //Get options from command
     int option;
     int argc_count = 1;
-    const char* options = ":spmh";
+    const char* options = ":spmfoandrxkglvcwytebh";
     while( (option = getopt(argc, argv, options)) != -1 ){
         switch(option){  
             case 's':
@@ -901,6 +3842,108 @@ int main(int argc, char** argv){
                     argc_count+=2;
                 }else exit_help("p flag", argv[0]);
                 break;
+            case 'f':
+                if(optind < argc){
+                    deal_file = argv[optind];
+                    argc_count+=2;
+                }else exit_help("f flag", argv[0]);
+                break;
+            case 'o':
+                if(optind < argc){
+                    output_file = argv[optind];
+                    argc_count+=2;
+                }else exit_help("o flag", argv[0]);
+                break;
+            case 'a':
+                if(optind < argc){
+                    analysis = argv[optind];
+                    argc_count+=2;
+                }else exit_help("a flag", argv[0]);
+                break;
+            case 'n':
+                if(optind < argc){
+                    perft_depth = atoi(argv[optind]);
+                    argc_count+=2;
+                }else exit_help("n flag", argv[0]);
+                break;
+            case 'd':
+                if(optind < argc){
+                    dd_deal = argv[optind];
+                    argc_count+=2;
+                }else exit_help("d flag", argv[0]);
+                break;
+            case 'r':
+                if(optind < argc){
+                    selective_width = atoi(argv[optind]);
+                    argc_count+=2;
+                }else exit_help("r flag", argv[0]);
+                break;
+            case 'x':
+                if(optind < argc){
+                    search_depth = atoi(argv[optind]);
+                    argc_count+=2;
+                }else exit_help("x flag", argv[0]);
+                break;
+            case 'k':
+                if(optind < argc){
+                    rollout_count = atoi(argv[optind]);
+                    argc_count+=2;
+                }else exit_help("k flag", argv[0]);
+                break;
+            case 'g':
+                if(optind < argc){
+                    lead_count_gen = atoi(argv[optind]);
+                    argc_count+=2;
+                }else exit_help("g flag", argv[0]);
+                break;
+            case 'l':
+                if(optind < argc){
+                    lead_file = argv[optind];
+                    argc_count+=2;
+                }else exit_help("l flag", argv[0]);
+                break;
+            case 'v':
+                if(optind < argc){
+                    variant = atoi(argv[optind]);
+                    argc_count+=2;
+                }else exit_help("v flag", argv[0]);
+                break;
+            case 'c':
+                if(optind < argc){
+                    ci_width = atof(argv[optind]);
+                    argc_count+=2;
+                }else exit_help("c flag", argv[0]);
+                break;
+            case 'w':
+                if(optind < argc){
+                    checkpoint_file = argv[optind];
+                    argc_count+=2;
+                }else exit_help("w flag", argv[0]);
+                break;
+            case 'y':
+                if(optind < argc){
+                    record_path = argv[optind];
+                    argc_count+=2;
+                }else exit_help("y flag", argv[0]);
+                break;
+            case 't':
+                if(optind < argc){
+                    tune_file = argv[optind];
+                    argc_count+=2;
+                }else exit_help("t flag", argv[0]);
+                break;
+            case 'e':
+                if(optind < argc){
+                    params_file = argv[optind];
+                    argc_count+=2;
+                }else exit_help("e flag", argv[0]);
+                break;
+            case 'b':
+                if(optind < argc){
+                    duel_file = argv[optind];
+                    argc_count+=2;
+                }else exit_help("b flag", argv[0]);
+                break;
             case 'm':
                 manual_deal = 1;
                 argc_count++;
@@ -921,6 +3964,84 @@ int main(int argc, char** argv){
         exit(EXIT_FAILURE);
     }
 
+    //Other table sizes are separate builds of the engine, named after this program with the number of players appended
+    if(variant != n_players){
+        run_variant(variant, given_argv);
+    }
+
+    //Perft mode verifies the move generator against known node counts
+    if(perft_depth > 0){
+        exit(run_perft(perft_depth, analysis) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    //Evaluation parameters apply to every mode, tuning starts from them
+    default_params(&params);
+    if(params_file != NULL){
+        load_params(params_file, &params);
+    }
+
+    //Tuning mode fits the evaluation parameters to recorded games
+    if(tune_file != NULL){
+        FILE* out = stdout;
+        if(output_file != NULL && (out = fopen(output_file, "w")) == NULL){
+            perror(output_file);
+            exit(EXIT_FAILURE);
+        }
+        run_tune(tune_file, out);
+        if(out != stdout){
+            fclose(out);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    //Games simulated by -s and -f are recorded for tuning
+    if(record_path != NULL && (record_file = fopen(record_path, "a")) == NULL){
+        perror(record_path);
+        exit(EXIT_FAILURE);
+    }
+
+    //The lead table is consulted by every later search, whatever the mode
+    if(lead_file != NULL){
+        load_lead_table(lead_file);
+    }
+
+    //Lead table mode precomputes opening leads offline
+    if(lead_count_gen > 0){
+        run_lead_table(lead_count_gen, output_file);
+        exit(EXIT_SUCCESS);
+    }
+
+    //Rollout mode checks and times the batched playout kernels
+    if(rollout_count > 0){
+        exit(run_rollouts(rollout_count) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    //Double dummy mode solves a fully known deal
+    if(dd_deal != NULL){
+        run_dd(dd_deal);
+        exit(EXIT_SUCCESS);
+    }
+
+    //Analysis mode searches a single given position
+    if(analysis != NULL){
+        analyze(analysis);
+        exit(EXIT_SUCCESS);
+    }
+
+    //Batch mode plays every deal from the deal file instead of a single deal
+    if(deal_file != NULL){
+        FILE* out = stdout;
+        if(output_file != NULL && (out = fopen(output_file, "w")) == NULL){
+            perror(output_file);
+            exit(EXIT_FAILURE);
+        }
+        run_batch(deal_file, out);
+        if(out != stdout){
+            fclose(out);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
     //Setup initial card array with every card appearing once 00 - 93
     card card_arr[n_cards];
     for(int i = 0; i < n_cards; i++){
@@ -928,6 +4049,14 @@ int main(int argc, char** argv){
         card_arr[i].suit = i/10;
     }
 
+    deal_rng = (unsigned long long)time(NULL) ^ ((unsigned long long)getpid() << 32);
+
+    //Duel mode plays the -b parameters against the -e ones (or the defaults), both ways round on each deal
+    if(duel_file != NULL){
+        run_duel(simulation_count, duel_file, params_file != NULL ? params_file : "default");
+        exit(EXIT_SUCCESS);
+    }
+
     //Either shuffle array to simulate random deal, or allow manual deal
     if(manual_deal){
         set_card_arr(card_arr);
@@ -941,13 +4070,77 @@ int main(int argc, char** argv){
 
     //Either simulate game of bots, or players vs bot
     if(simulation){
-        float avg = 0;
-        for(int i = 0; i < simulation_count; i++){
-            avg += simulate(card_arr, players);
+        checkpoint ck;
+        memset(&ck, 0, sizeof(ck));
+        ck.magic = checkpoint_magic;
+        ck.players = n_players;
+        ck.depth = search_depth;
+        ck.width = selective_width;
+        ck.simulation_count = simulation_count;
+        ck.ci_width = ci_width;
+        ck.params = params;
+        ck.lead_hash = lead_hash;
+        ck.record_offset = record_file != NULL ? 0 : -1;
+        if(checkpoint_file != NULL && load_checkpoint(checkpoint_file, &ck)){
+            deal_rng = ck.rng;
+            lead_probes = ck.lead_probes;
+            lead_hits = ck.lead_hits;
+            //Games recorded after the checkpoint are played again, so their records are dropped
+            if(record_file != NULL){
+                if(record_length() < ck.record_offset){
+                    fprintf(stderr, "Error: Record file %s is shorter than when %s was saved.\n", record_path, checkpoint_file);
+                    exit(EXIT_FAILURE);
+                }
+                if(ftruncate(fileno(record_file), ck.record_offset) != 0){
+                    perror(record_path);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            cp_set(ck.card_arr, card_arr, n_cards);
             init_players(players, n_players, card_arr);
+            printf("Resuming %s after %lld games\n", checkpoint_file, ck.stats.games);
+        }
+        game_stats* stats = &ck.stats;
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        double last_report = 0, last_checkpoint = 0;
+        //Stop early once the mean is known to the requested precision
+        int converged = 0;
+        while(stats->games < simulation_count && !converged){
+            game_result result;
+            free_cache();
+            simulate(card_arr, players, &result);
+            stats_add(stats, &result);
             shuffle_card_arr(card_arr, n_cards);
+            init_players(players, n_players, card_arr);
+            converged = (ci_width > 0 && stats->games >= stats_min_games && 2*stats_ci(stats) <= ci_width);
+
+            double seconds = elapsed(start);
+            if(seconds - last_report >= stats_report_seconds && stats->games < simulation_count){
+                stats_progress(stats, seconds);
+                last_report = seconds;
+            }
+            if(checkpoint_file != NULL && (seconds - last_checkpoint >= checkpoint_seconds || stats->games == simulation_count || converged)){
+                ck.rng = deal_rng;
+                ck.lead_probes = lead_probes;
+                ck.lead_hits = lead_hits;
+                if(record_file != NULL){
+                    ck.record_offset = record_length();
+                }
+                cp_set(card_arr, ck.card_arr, n_cards);
+                save_checkpoint(checkpoint_file, &ck);
+                last_checkpoint = seconds;
+            }
+        }
+        if(converged){
+            printf("Confidence interval width %.2f reached after %lld games\n", 2*stats_ci(stats), stats->games);
+        }
+        printf("Average Evaluation over %lld simulations: %f\n", stats->games, stats->mean);
+        stats_report(stats);
+        if(lead_table != NULL){
+            printf("Lead table: %lld of %lld opening leads found (%.1f%%)\n", lead_hits, lead_probes, lead_probes > 0 ? 100.0 * lead_hits / lead_probes : 0);
         }
-        printf("Average Evaluation over %d simulations: %f\n", simulation_count, avg/simulation_count);
         exit(EXIT_SUCCESS);
     }else if(pvb){
         for(int i = 0; i < n_players; i++){